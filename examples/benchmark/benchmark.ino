@@ -0,0 +1,154 @@
+// Benchmarks the library against whatever thermometers are attached to the
+// bus (real ones, or fake ones when running under roo_testing). Measures
+// update() (with and without newly discovered devices), reading the results
+// after conversion, and role lookups, both in wall time and in bus operations.
+//
+// Prints CSV, one line per measured phase, so that results can be collected
+// and compared across library versions and communication strategies.
+//
+// Under roo_testing, the fake bus answers instantly; define SIMULATE_BUS to
+// attach a timing and reliability model, so that bus_time_us and the failure
+// counts reflect a real bus of the specified cable length.
+//
+// For fixed, reproducible bus populations (1 to 256 thermometers of mixed
+// families), see the onewire_benchmark target in BUILD.
+
+#include <vector>
+
+#include "Arduino.h"
+#include "roo_onewire.h"
+#include "roo_onewire/thermometer_roles.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+using namespace roo_onewire;
+using namespace roo_scheduler;
+using namespace roo_time;
+
+const int kOneWirePin = 14;
+const int kIterations = 10;
+const int kLookupIterations = 1000;
+
+Scheduler scheduler;
+roo_onewire::OneWire onewire(kOneWirePin, scheduler);
+
+// Keeps role assignments in RAM, so that the benchmark does not touch flash.
+class InMemoryStore : public ThermometerRoleStore {
+ public:
+  RomCode getRomCode(int id) override {
+    return id < (int)codes_.size() ? codes_[id] : RomCode();
+  }
+  void setRomCode(int id, RomCode rom_code) override {
+    if (id >= (int)codes_.size()) codes_.resize(id + 1);
+    codes_[id] = rom_code;
+  }
+  void clearRomCode(int id) override { setRomCode(id, RomCode()); }
+
+ private:
+  std::vector<RomCode> codes_;
+};
+
+InMemoryStore store;
+
+#ifdef SIMULATE_BUS
+BusSimulation simulation([]() {
+  BusSimulation::Options options;
+  options.cable_length_m = 50;
+  return options;
+}());
+#endif
+
+// Set by the listener, when the conversion results have been read.
+Uptime read_completed;
+BusStats read_stats;
+
+Thermometers::ConversionListener listener([]() {
+  read_completed = Uptime::Now();
+  read_stats = onewire.busStats();
+});
+
+void printHeader() {
+  Serial.println(
+      "phase,devices,iterations,wall_us,resets,presence_failures,searches,"
+      "slots,bytes_written,bytes_read,overdrive_slots,bus_time_us");
+}
+
+void print(const char* phase, int iterations, Interval elapsed,
+           const BusStats& stats) {
+  Serial.printf("%s,%d,%d,%lld,%u,%u,%u,%u,%u,%u,%u,%lld\n", phase,
+                onewire.thermometers().count(), iterations,
+                (long long)elapsed.inMicros(), stats.resets,
+                stats.presence_failures, stats.searches, stats.slots,
+                stats.bytes_written, stats.bytes_read, stats.overdrive_slots,
+                (long long)stats.bus_time_micros);
+}
+
+// Runs a complete cycle: update(), followed by waiting for the conversion
+// and reading the results.
+void cycle(const char* update_phase, const char* read_phase = "read_results") {
+  onewire.resetBusStats();
+  Uptime start = Uptime::Now();
+  onewire.update();
+  print(update_phase, 1, Uptime::Now() - start, onewire.busStats());
+  onewire.resetBusStats();
+  Uptime conversion_done = onewire.thermometers().getPendingConversionTime();
+  scheduler.delayUntil(conversion_done);
+  print(read_phase, 1, read_completed - conversion_done, read_stats);
+}
+
+void benchmarkRoles() {
+  int count = onewire.thermometers().count();
+  std::vector<ThermometerRoles::Spec> specs;
+  for (int i = 0; i < count; ++i) {
+    specs.push_back(ThermometerRoles::Spec{i, "role"});
+  }
+  ThermometerRoles roles(onewire, store, specs);
+  std::vector<int> role_indexes;
+  for (int i = 0; i < count; ++i) {
+    role_indexes.push_back(roles.roleIndexById(i));
+  }
+  for (int i = 0; i < count; ++i) {
+    roles.assign(i, onewire.thermometers().rom_code(i));
+  }
+  onewire.resetBusStats();
+  volatile float sink = 0;
+  Uptime start = Uptime::Now();
+  for (int n = 0; n < kLookupIterations; ++n) {
+    for (int i = 0; i < count; ++i) {
+      sink = roles.temperatureById(i).degCelcius();
+    }
+  }
+  print("roles_temperature_by_id", kLookupIterations * count,
+        Uptime::Now() - start, onewire.busStats());
+  std::vector<roo_temperature::Temperature> out(count);
+  start = Uptime::Now();
+  for (int n = 0; n < kLookupIterations; ++n) {
+    roles.temperaturesByIndexes(&role_indexes[0], &out[0], count);
+  }
+  print("roles_temperatures_by_indexes", kLookupIterations * count,
+        Uptime::Now() - start, onewire.busStats());
+}
+
+void setup() {
+  Serial.begin(115200);
+#ifdef SIMULATE_BUS
+  onewire.setBusSimulation(&simulation);
+#endif
+  onewire.thermometers().addEventListener(&listener);
+  printHeader();
+  // The first cycle discovers all devices.
+  cycle("update_cold");
+  // Subsequent cycles re-run discovery, but find no new devices.
+  for (int i = 0; i < kIterations; ++i) {
+    cycle("update_warm");
+  }
+  // Same, but reading only the temperature bytes of the scratchpads.
+  onewire.thermometers().setReadIntegrity(Thermometers::READ_INTEGRITY_PARTIAL);
+  for (int i = 0; i < kIterations; ++i) {
+    cycle("update_warm", "read_results_partial");
+  }
+  onewire.thermometers().setReadIntegrity(Thermometers::READ_INTEGRITY_FULL);
+  if (onewire.thermometers().count() > 0) benchmarkRoles();
+}
+
+void loop() {}
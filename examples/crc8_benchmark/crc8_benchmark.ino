@@ -0,0 +1,46 @@
+// Compares the speed of the available CRC8 implementations on your hardware,
+// to help choose the value of ROO_ONEWIRE_CRC8 (see roo_onewire/crc8.h).
+//
+// Prints one CSV line per implementation: name, input, iterations, total
+// microseconds, and nanoseconds per call.
+
+#include "Arduino.h"
+#include "roo_onewire/crc8.h"
+
+using namespace roo_onewire;
+
+static const int kIterations = 100000;
+
+// A sample rom code, and a sample scratchpad.
+static const uint64_t kRomCode = 0x4416504A6BFF4A28ULL;
+static const uint8_t kScratchpad[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F,
+                                       0xFF, 0x0C, 0x10, 0x1C};
+
+// Prevents the compiler from optimizing the computations away.
+volatile uint8_t sink;
+
+template <typename Fn>
+void measure(const char* name, const char* input, Fn fn) {
+  unsigned long start = micros();
+  for (int i = 0; i < kIterations; ++i) {
+    sink = fn();
+  }
+  unsigned long elapsed = micros() - start;
+  Serial.printf("%s,%s,%d,%lu,%lu\n", name, input, kIterations, elapsed,
+                (unsigned long)(elapsed * 1000ULL / kIterations));
+}
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println("impl,input,iterations,total_us,ns_per_call");
+  measure("bitwise", "scratchpad",
+          []() { return Crc8Bitwise(kScratchpad, 8); });
+  measure("nibble", "scratchpad", []() { return Crc8Nibble(kScratchpad, 8); });
+  measure("table", "scratchpad", []() { return Crc8Table(kScratchpad, 8); });
+  measure("bitwise", "rom_code",
+          []() { return RomCodeCrc8Bitwise(kRomCode); });
+  measure("nibble", "rom_code", []() { return RomCodeCrc8Nibble(kRomCode); });
+  measure("table", "rom_code", []() { return RomCodeCrc8Table(kRomCode); });
+}
+
+void loop() {}
@@ -75,7 +75,9 @@ void setup() {
   // By default, the assignments are stored in Flash. (To override, use a
   // 3-parameter constructor when creating ThermometerRoles). Because of this,
   // the second time you run the sketch, the thermometers will be already
-  // assigned.
+  // assigned. Alternatively, you can keep the assignments on the thermometers
+  // themselves, by passing a ScratchpadThermometerRoleStore; the roles are then
+  // resolved during discovery, and they follow the devices.
   LOG(INFO) << kitchen;
   LOG(INFO) << bedroom;
   // Trigger discovery, to see if we may have some unassigned thermometers.
@@ -0,0 +1,52 @@
+// This example illustrates use of a fixed installation, where the set of
+// thermometers is known in advance. The rom codes are compile-time constants,
+// so there is no discovery, and no dynamic memory allocation.
+//
+// (You can find out the rom codes of your thermometers by running the
+// 'synchronous' example.)
+
+#include "Arduino.h"
+#include "roo_onewire/static_onewire.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+using namespace roo_onewire;
+using namespace roo_scheduler;
+using namespace roo_time;
+
+const int kOneWirePin = 14;
+
+// Replace with the rom codes of your thermometers.
+using Indoor = StaticThermometer<0x6B0000000ABCDE28>;
+using Outdoor = StaticThermometer<0x3D0000000ABCDF28, RESOLUTION_10_BITS>;
+
+Scheduler scheduler;
+StaticOneWire<Indoor, Outdoor> onewire(kOneWirePin, scheduler);
+
+// Triggers conversion every two seconds.
+RepetitiveTask converter(
+    scheduler,
+    []() {
+      if (!onewire.update()) {
+        LOG(WARNING) << "OneWire update failed; is the bus connected?";
+      }
+    },
+    Seconds(2));
+
+// Called when conversion completes.
+Thermometers::ConversionListener listener([]() {
+  LOG(INFO) << "Indoor: " << onewire.thermometer(0).temperature();
+  LOG(INFO) << "Outdoor: " << onewire.thermometer(1).temperature();
+});
+
+void setup() {
+  // Optional: check that the thermometers are actually there, and apply the
+  // configured resolutions.
+  if (!onewire.verifyPresence()) {
+    LOG(WARNING) << "Some thermometers are missing.";
+  }
+  onewire.addEventListener(&listener);
+  converter.startInstantly();
+}
+
+void loop() { scheduler.executeEligibleTasksUpToNow(); }
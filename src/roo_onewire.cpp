@@ -1,9 +1,8 @@
 #include "roo_onewire.h"
 
+#include "roo_onewire/commands.h"
 #include "roo_onewire/rom_code.h"
 
-static const uint8_t kReadPowerSupply = 0xB4;
-
 #ifdef ROO_TESTING
 #include "roo_testing/devices/microcontroller/esp32/fake_esp32.h"
 #endif
@@ -11,6 +10,9 @@ namespace roo_onewire {
 
 namespace {
 
+// Upper bound on the chain length, guarding against a stuck bus.
+static const int kMaxChainLength = 256;
+
 bool IsThermometerFamilySupported(uint8_t family) {
   return family == 0x10 || family == 0x28 || family == 0x22 || family == 0x3B ||
          family == 0x42;
@@ -20,36 +22,155 @@ bool IsThermometerFamilySupported(uint8_t family) {
 
 #ifdef ROO_TESTING
 
-namespace {
-FakeOneWireInterface* findOrFail(uint8_t pin) {
+FakeOneWireInterface* FindFakeBus(uint8_t pin) {
   auto itr = FakeEsp32().onewire_buses().find(pin);
   CHECK(itr != FakeEsp32().onewire_buses().end())
       << "No OneWire bus on pin " << (int)pin;
   return itr->second;
 }
-}  // namespace
 
 OneWire::OneWire(uint8_t pin, roo_scheduler::Scheduler& scheduler)
-    : onewire_(findOrFail(pin)), thermometers_(*this, scheduler) {}
+    : onewire_(FindFakeBus(pin)),
+      arbiter_(onewire_),
+      thermometers_(*this, scheduler),
+      chain_discovery_(false),
+      chain_eligible_(false),
+      devices_on_bus_(0),
+      discovered_(ROO_ONEWIRE_MAX_DEVICES > 0 ? ROO_ONEWIRE_MAX_DEVICES : 8),
+      discovery_micros_(0) {}
 #else
 OneWire::OneWire(uint8_t pin, roo_scheduler::Scheduler& scheduler)
-    : onewire_(pin), thermometers_(*this, scheduler) {}
+    : onewire_(pin),
+      arbiter_(onewire_),
+      thermometers_(*this, scheduler),
+      chain_discovery_(false),
+      chain_eligible_(false),
+      devices_on_bus_(0),
+      discovered_(ROO_ONEWIRE_MAX_DEVICES > 0 ? ROO_ONEWIRE_MAX_DEVICES : 8),
+      discovery_micros_(0) {}
 #endif
 
-RomCodeSet OneWire::discoverAll() {
-  RomCodeSet result(thermometers_.count() > 0 ? thermometers_.count() : 8);
+const RomCodeSet& OneWire::discoverAll() {
+  BusStats before = onewire_.stats();
+  roo_time::Uptime start = roo_time::Uptime::Now();
+  const RomCodeSet& result = discover();
+  discovery_micros_ += (roo_time::Uptime::Now() - start).inMicros();
+  discovery_stats_ += onewire_.stats() - before;
+  return result;
+}
+
+const RomCodeSet& OneWire::discover() {
+  RomCodeSet& result = discovered_;
+  result.clear();
+  if (chain_discovery_ && chain_eligible_) {
+    int length;
+    if (discoverChain(chain_, length) && !chain_.empty()) {
+      for (RomCode rom_code : chain_) {
+        result.insert(rom_code);
+      }
+      devices_on_bus_ = length;
+      return result;
+    }
+    LOG(WARNING) << "Chain discovery failed; falling back to search";
+  }
+  chain_eligible_ = false;
+  chain_.clear();
   onewire_.reset_search();
   OneWireDeviceAddress addr;
+  devices_on_bus_ = 0;
   while (onewire_.search(addr)) {
     RomCode rom_code(addr);
-    if (rom_code.isValidUnicast() &&
-        IsThermometerFamilySupported(rom_code.getFamily())) {
-      result.insert(rom_code);
+    if (!rom_code.isValidUnicast()) continue;
+    ++devices_on_bus_;
+    if (!IsThermometerFamilySupported(rom_code.getFamily())) continue;
+    if (ROO_ONEWIRE_MAX_DEVICES > 0 &&
+        (int)result.size() >= ROO_ONEWIRE_MAX_DEVICES) {
+      LOG(WARNING) << "Ignoring " << rom_code << ": more than "
+                   << ROO_ONEWIRE_MAX_DEVICES << " devices on the bus";
+      continue;
+    }
+    result.insert(rom_code);
+  }
+  if (!chain_discovery_ || result.empty() ||
+      devices_on_bus_ != (int)result.size()) {
+    return result;
+  }
+  for (RomCode rom_code : result) {
+    if (rom_code.getFamily() != 0x42) return result;
+  }
+  // All devices are DS28EA00; learn their physical order, and use chain mode
+  // from now on if it agrees with the search.
+  int length;
+  if (!discoverChain(chain_, length) || length != (int)result.size()) {
+    chain_.clear();
+    return result;
+  }
+  for (RomCode rom_code : chain_) {
+    if (!result.contains(rom_code)) {
+      chain_.clear();
+      return result;
     }
   }
+  chain_eligible_ = true;
   return result;
 }
 
+bool OneWire::chainControl(uint8_t control) {
+  onewire_.write(kChain);
+  onewire_.write(control);
+  onewire_.write(~control);
+  return onewire_.read() == kChainAck;
+}
+
+bool OneWire::discoverChain(std::vector<RomCode>& sequence, int& length) {
+  sequence.clear();
+  length = 0;
+  if (!onewire_.reset()) return false;
+  onewire_.skip();
+  if (!chainControl(kChainOn)) return false;
+  bool ok = true;
+  while (true) {
+    if (!onewire_.reset()) {
+      ok = false;
+      break;
+    }
+    // Only the first device that has not yet been marked done, and whose EN
+    // input is enabled by its predecessor, responds.
+    onewire_.write(kConditionalReadRom);
+    OneWireDeviceAddress addr;
+    for (int i = 0; i < 8; ++i) {
+      addr[i] = onewire_.read();
+    }
+    RomCode rom_code(addr);
+    if (rom_code.isBroadcast()) {
+      // No response; the end of the chain.
+      break;
+    }
+    if (!rom_code.isValidUnicast() || length >= kMaxChainLength) {
+      LOG(ERROR) << "Invalid rom code in chain discovery: " << rom_code;
+      ok = false;
+      break;
+    }
+    ++length;
+    if (ROO_ONEWIRE_MAX_DEVICES > 0 &&
+        (int)sequence.size() >= ROO_ONEWIRE_MAX_DEVICES) {
+      LOG(WARNING) << "Ignoring " << rom_code << ": more than "
+                   << ROO_ONEWIRE_MAX_DEVICES << " devices on the bus";
+    } else {
+      sequence.push_back(rom_code);
+    }
+    // The device is now selected; marking it done enables the next one.
+    if (!chainControl(kChainDone)) {
+      ok = false;
+      break;
+    }
+  }
+  if (!onewire_.reset()) return false;
+  onewire_.skip();
+  if (!chainControl(kChainOff)) return false;
+  return ok;
+}
+
 bool OneWire::update() { return thermometers_.update(); }
 
 }  // namespace roo_onewire
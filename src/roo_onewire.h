@@ -1,6 +1,7 @@
 #pragma once
 
 #include "roo_onewire/bus.h"
+#include "roo_onewire/bus_arbiter.h"
 #include "roo_onewire/rom_code.h"
 #include "roo_onewire/thermometers.h"
 #include "roo_scheduler.h"
@@ -18,6 +19,20 @@ class OneWire {
   // immediately returns true.
   bool update();
 
+  // Requests conversion only on the specified thermometers, without running
+  // discovery. Returns true if the conversion request has been issued. See
+  // Thermometers::updateSelected().
+  bool updateSelected(const RomCode* rom_codes, int count) {
+    return thermometers_.updateSelected(rom_codes, count);
+  }
+
+  // Requests readings that are at most `max_age` old, and calls `callback`
+  // when they are available. See Thermometers::requestReading().
+  void requestReading(roo_time::Interval max_age,
+                      std::function<void(bool)> callback) {
+    thermometers_.requestReading(max_age, std::move(callback));
+  }
+
   // Returns the collection of all thermometers that have been recently
   // discovered, along with their cached state (e.g. temperature readings.)
   Thermometers& thermometers() { return thermometers_; }
@@ -25,10 +40,90 @@ class OneWire {
   // Const version of the above.
   const Thermometers& thermometers() const { return thermometers_; }
 
+  // Returns the arbiter that other drivers can use to borrow the bus between
+  // the thermometer transactions (e.g. while a conversion is in progress).
+  // See BusArbiter.
+  BusArbiter& arbiter() { return arbiter_; }
+
+  // Returns when the library next needs to run. Between the returned time and
+  // the previous call to the scheduler, the application may sleep. See
+  // Thermometers::nextWakeup().
+  Wakeup nextWakeup() const { return thermometers_.nextWakeup(); }
+
+  // Returns the counters of bus operations performed so far.
+  const BusStats& busStats() const { return onewire_.stats(); }
+
+  // Returns the counters of bus operations spent on discovery (a subset of
+  // busStats()), so that its cost can be told apart from that of the
+  // conversions and reads.
+  const BusStats& discoveryStats() const { return discovery_stats_; }
+
+  // Returns the time spent on discovery (as measured by the uptime clock),
+  // since the counters were last reset.
+  roo_time::Interval discoveryTime() const {
+    return roo_time::Micros(discovery_micros_);
+  }
+
+  // Zeroes the counters of bus operations, and the discovery time.
+  void resetBusStats() {
+    onewire_.resetStats();
+    discovery_stats_ = BusStats();
+    discovery_micros_ = 0;
+  }
+
+  // Enables discovery using the DS28EA00 chain mode, which enumerates the
+  // devices in the order in which they are connected along the cable, and
+  // costs about half of the bus time of the binary search. Chain mode is used
+  // only when the previous discovery found nothing but DS28EA00 devices (and
+  // their chain agreed with the search); otherwise, the regular search is
+  // used. Since devices of other families do not take part in the chain,
+  // newly attached ones are not noticed until chain discovery fails, or until
+  // chain mode gets disabled. Defaults to false.
+  void setChainDiscovery(bool enabled) {
+    chain_discovery_ = enabled;
+    chain_eligible_ = false;
+    chain_.clear();
+  }
+
+  bool isChainDiscovery() const { return chain_discovery_; }
+
+  // Returns the rom codes of the devices in the order in which they are
+  // connected along the cable (starting with the one nearest to the master),
+  // as determined by the most recent discovery. Empty if the order is not
+  // known (e.g. chain discovery is disabled, or not all devices on the bus
+  // are DS28EA00).
+  const std::vector<RomCode>& chain() const { return chain_; }
+
+  // Returns the number of devices (of any family) found on the bus by the most
+  // recent discovery.
+  int devicesOnBus() const { return devices_on_bus_; }
+
+  // Attaches a timing and reliability model to the bus (or detaches it, if
+  // nullptr). See BusSimulation.
+  void setBusSimulation(BusSimulation* simulation) {
+    onewire_.setSimulation(simulation);
+  }
+
  private:
   friend class Thermometers;
 
-  RomCodeSet discoverAll();
+  // Runs discovery, and returns the rom codes of the thermometers found. The
+  // result remains valid until the next call.
+  const RomCodeSet& discoverAll();
+
+  // Implements the above, without accounting discovery_stats_ and
+  // discovery_micros_.
+  const RomCodeSet& discover();
+
+  // Enumerates DS28EA00 devices using the chain mode, storing their rom codes
+  // in `sequence`, in the physical order, and their number in `length`. With
+  // ROO_ONEWIRE_MAX_DEVICES set, the devices past that limit are counted, but
+  // not stored. Returns false on bus errors.
+  bool discoverChain(std::vector<RomCode>& sequence, int& length);
+
+  // Sends the chain command with the specified control byte to the currently
+  // selected devices. Returns true if acknowledged.
+  bool chainControl(uint8_t control);
 
   void readPowerSupply();
 
@@ -37,7 +132,30 @@ class OneWire {
   // The bus.
   Bus onewire_;
 
+  BusArbiter arbiter_;
+
   Thermometers thermometers_;
+
+  // Whether to use chain mode for discovery, when possible.
+  bool chain_discovery_;
+
+  // Whether the previous discovery found DS28EA00 devices only.
+  bool chain_eligible_;
+
+  // Physical order of the devices, if known.
+  std::vector<RomCode> chain_;
+
+  // Number of devices found by the most recent discovery.
+  int devices_on_bus_;
+
+  // Result of the most recent discovery; kept to reuse the capacity.
+  RomCodeSet discovered_;
+
+  // See discoveryStats().
+  BusStats discovery_stats_;
+
+  // See discoveryTime().
+  int64_t discovery_micros_;
 };
 
 }  // namespace roo_onewire
\ No newline at end of file
@@ -0,0 +1,194 @@
+#include "roo_onewire/adaptive_sampler.h"
+
+using roo_time::Interval;
+using roo_time::Micros;
+using roo_time::Uptime;
+
+namespace roo_onewire {
+
+namespace {
+
+// Estimated bus time of searching for a single device: reset, Search ROM, and
+// three slots per bit of the rom code.
+static const int32_t kSearchMicrosPerDevice =
+    BusTiming::kResetMicros + (8 + 3 * 64) * BusTiming::kSlotMicros;
+
+// Estimated bus time of requesting a conversion from a single device: reset,
+// Match ROM, and Convert T.
+static const int32_t kConvertMicrosPerDevice =
+    BusTiming::kResetMicros + (8 + 64 + 8) * BusTiming::kSlotMicros;
+
+}  // namespace
+
+AdaptiveSampler::DeviceState::DeviceState()
+    : last_raw(kUnknownRawTemperature),
+      last_time(Uptime::Start()),
+      next_due(Uptime::Start()) {}
+
+AdaptiveSampler::AdaptiveSampler(OneWire& onewire,
+                                 roo_scheduler::Scheduler& scheduler,
+                                 const Options& options)
+    : onewire_(onewire),
+      options_(options),
+      listener_(*this),
+      cycle_task_(scheduler, [this]() { cycle(); }),
+      next_cycle_(Uptime::Max()),
+      active_(false),
+      next_discovery_(Uptime::Start()),
+      utilization_start_(Uptime::Now()),
+      utilization_start_bus_time_(0) {
+  onewire_.thermometers().addEventListener(&listener_);
+}
+
+AdaptiveSampler::~AdaptiveSampler() {
+  onewire_.thermometers().removeEventListener(&listener_);
+}
+
+void AdaptiveSampler::start() {
+  active_ = true;
+  next_discovery_ = Uptime::Now();
+  resetUtilization();
+  scheduleCycle(Uptime::Now());
+}
+
+void AdaptiveSampler::stop() {
+  active_ = false;
+  next_cycle_ = Uptime::Max();
+}
+
+void AdaptiveSampler::setBounds(RomCode rom_code, Interval min_interval,
+                                Interval max_interval) {
+  DeviceState& s = state(rom_code);
+  s.min_interval = min_interval;
+  s.max_interval = max_interval;
+  if (s.interval < min_interval) s.interval = min_interval;
+  if (s.interval > max_interval) s.interval = max_interval;
+}
+
+Interval AdaptiveSampler::interval(RomCode rom_code) const {
+  auto itr = states_.find(rom_code);
+  return itr == states_.end() ? options_.min_interval : itr->second.interval;
+}
+
+float AdaptiveSampler::busUtilization() const {
+  int64_t wall = (Uptime::Now() - utilization_start_).inMicros();
+  if (wall <= 0) return 0.0f;
+  return (float)(onewire_.busStats().bus_time_micros -
+                 utilization_start_bus_time_) /
+         (float)wall;
+}
+
+void AdaptiveSampler::resetUtilization() {
+  utilization_start_ = Uptime::Now();
+  utilization_start_bus_time_ = onewire_.busStats().bus_time_micros;
+}
+
+AdaptiveSampler::DeviceState& AdaptiveSampler::state(RomCode rom_code) {
+  if (states_.contains(rom_code)) return states_[rom_code];
+  DeviceState& s = states_[rom_code];
+  s.min_interval = options_.min_interval;
+  s.max_interval = options_.max_interval;
+  s.interval = options_.min_interval;
+  return s;
+}
+
+Wakeup AdaptiveSampler::nextWakeup() const {
+  Wakeup wakeup = onewire_.nextWakeup();
+  if (next_cycle_ == Uptime::Max()) return wakeup;
+  int32_t micros;
+  if (next_cycle_ >= next_discovery_) {
+    micros = onewire_.devicesOnBus() * kSearchMicrosPerDevice +
+             onewire_.thermometers().count() * kConvertMicrosPerDevice;
+  } else {
+    // Upper bound; typically, only some of the thermometers are due.
+    micros = onewire_.thermometers().count() * kConvertMicrosPerDevice;
+  }
+  return Wakeup::Earliest(wakeup, Wakeup(next_cycle_, Micros(micros)));
+}
+
+void AdaptiveSampler::cycle() {
+  next_cycle_ = Uptime::Max();
+  if (!active_) return;
+  const Thermometers& thermometers = onewire_.thermometers();
+  if (thermometers.isConversionPending()) {
+    // Someone else has requested a conversion; we'll pick up its results.
+    return;
+  }
+  Uptime now = Uptime::Now();
+  if (now >= next_discovery_) {
+    next_discovery_ = now + options_.discovery_interval;
+    if (onewire_.update()) return;
+    // Nothing on the bus; retry at the next discovery.
+    scheduleCycle(next_discovery_);
+    return;
+  }
+  due_.clear();
+  for (int i = 0; i < thermometers.count(); ++i) {
+    RomCode rom_code = thermometers.rom_code(i);
+    if (state(rom_code).next_due <= now) due_.push_back(rom_code);
+  }
+  if (due_.empty()) {
+    scheduleNext();
+    return;
+  }
+  if (!onewire_.updateSelected(&due_[0], due_.size())) {
+    // E.g. the bus is down. The thermometers remain due, so back off, rather
+    // than retrying right away.
+    scheduleNext(now + options_.min_interval);
+  }
+}
+
+void AdaptiveSampler::conversionCompleted() {
+  const Thermometers& thermometers = onewire_.thermometers();
+  for (const Thermometer& t : thermometers) {
+    // With grouped conversions, the groups complete at different times; pick
+    // up every reading not seen yet.
+    DeviceState& s = state(t.rom_code());
+    Uptime reading_time = t.reading_time();
+    if (reading_time <= s.last_time) continue;
+    int16_t raw = t.raw_temperature();
+    if (raw == kUnknownRawTemperature) {
+      // Failed read; retry soon.
+      s.interval = s.min_interval;
+    } else if (s.last_raw != kUnknownRawTemperature &&
+               s.last_time != Uptime::Start()) {
+      int64_t elapsed = (reading_time - s.last_time).inMicros();
+      int32_t change = raw - s.last_raw;
+      if (change < 0) change = -change;
+      Interval target;
+      if (change == 0) {
+        // Stable; back off gradually.
+        target = Micros(s.interval.inMicros() * 3 / 2);
+      } else {
+        target = Micros(elapsed * options_.target_change / change);
+      }
+      // Smooth, so that a single outlier does not swing the interval.
+      Interval next = Micros((s.interval.inMicros() + target.inMicros()) / 2);
+      if (next < s.min_interval) next = s.min_interval;
+      if (next > s.max_interval) next = s.max_interval;
+      s.interval = next;
+    }
+    s.last_raw = raw;
+    s.last_time = reading_time;
+    s.next_due = reading_time + s.interval;
+  }
+  if (active_) scheduleNext();
+}
+
+void AdaptiveSampler::scheduleNext(Uptime not_before) {
+  Uptime next = next_discovery_;
+  const Thermometers& thermometers = onewire_.thermometers();
+  for (int i = 0; i < thermometers.count(); ++i) {
+    Uptime due = state(thermometers.rom_code(i)).next_due;
+    if (due < next) next = due;
+  }
+  if (next < not_before) next = not_before;
+  scheduleCycle(next);
+}
+
+void AdaptiveSampler::scheduleCycle(Uptime when) {
+  next_cycle_ = when;
+  cycle_task_.scheduleOn(when);
+}
+
+}  // namespace roo_onewire
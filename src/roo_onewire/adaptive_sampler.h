@@ -0,0 +1,130 @@
+#pragma once
+
+#include "roo_collections/flat_small_hash_map.h"
+#include "roo_onewire.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+namespace roo_onewire {
+
+// Drives the conversions on a OneWire bus, giving each thermometer its own
+// sampling interval, adapted to how fast its temperature changes. Stable
+// thermometers are sampled rarely, and fast-changing ones often, within
+// configurable bounds. Each cycle converts and reads only the thermometers
+// that are due, so that the bus time goes where it is needed.
+//
+// The sampler calls OneWire::update() (with discovery) periodically, and
+// OneWire::updateSelected() in between. Use it instead of (not in addition
+// to) calling update() on your own.
+class AdaptiveSampler {
+ public:
+  struct Options {
+    Options()
+        : min_interval(roo_time::Seconds(1)),
+          max_interval(roo_time::Seconds(60)),
+          target_change(8),
+          discovery_interval(roo_time::Seconds(60)) {}
+
+    // Default bounds of the per-thermometer sampling interval.
+    roo_time::Interval min_interval;
+    roo_time::Interval max_interval;
+
+    // The temperature change, in 1/16 °C, that the sampler aims to observe
+    // between consecutive samples. Smaller values result in more frequent
+    // sampling.
+    int16_t target_change;
+
+    // How often to run discovery (with all thermometers sampled).
+    roo_time::Interval discovery_interval;
+  };
+
+  AdaptiveSampler(OneWire& onewire, roo_scheduler::Scheduler& scheduler)
+      : AdaptiveSampler(onewire, scheduler, Options()) {}
+
+  AdaptiveSampler(OneWire& onewire, roo_scheduler::Scheduler& scheduler,
+                  const Options& options);
+
+  ~AdaptiveSampler();
+
+  // Starts sampling, beginning with a full update.
+  void start();
+
+  void stop();
+
+  // Overrides the interval bounds for the thermometer with the specified rom
+  // code. (To set bounds for a role, pass the role's rom code.)
+  void setBounds(RomCode rom_code, roo_time::Interval min_interval,
+                 roo_time::Interval max_interval);
+
+  // Returns the current sampling interval of the specified thermometer.
+  roo_time::Interval interval(RomCode rom_code) const;
+
+  // Returns the fraction of time that the bus has spent communicating, since
+  // start() or the last call to resetUtilization(). Conversion time is not
+  // included.
+  float busUtilization() const;
+
+  void resetUtilization();
+
+  // Returns when the library next needs to run, including the sampling
+  // cycles and the periodic discovery. See OneWire::nextWakeup().
+  Wakeup nextWakeup() const;
+
+ private:
+  class Listener : public Thermometers::EventListener {
+   public:
+    Listener(AdaptiveSampler& sampler) : sampler_(sampler) {}
+    void conversionCompleted() const override {
+      sampler_.conversionCompleted();
+    }
+
+   private:
+    AdaptiveSampler& sampler_;
+  };
+
+  struct DeviceState {
+    DeviceState();
+
+    roo_time::Interval min_interval;
+    roo_time::Interval max_interval;
+    roo_time::Interval interval;
+
+    int16_t last_raw;
+    roo_time::Uptime last_time;
+    roo_time::Uptime next_due;
+  };
+
+  void cycle();
+  void conversionCompleted();
+
+  // Schedules the next cycle when the earliest thermometer is due, but not
+  // before `not_before`.
+  void scheduleNext(roo_time::Uptime not_before = roo_time::Uptime::Start());
+
+  // Schedules the cycle task at the specified time.
+  void scheduleCycle(roo_time::Uptime when);
+
+  DeviceState& state(RomCode rom_code);
+
+  OneWire& onewire_;
+  Options options_;
+  Listener listener_;
+  roo_scheduler::SingletonTask cycle_task_;
+
+  // When the cycle task is scheduled to run; Uptime::Max() if not.
+  roo_time::Uptime next_cycle_;
+
+  bool active_;
+  roo_time::Uptime next_discovery_;
+
+  roo_collections::FlatSmallHashMap<RomCode, DeviceState, RomCodeHashFn>
+      states_;
+
+  // Reused across cycles.
+  std::vector<RomCode> due_;
+
+  roo_time::Uptime utilization_start_;
+  int64_t utilization_start_bus_time_;
+};
+
+}  // namespace roo_onewire
@@ -1,18 +1,475 @@
 #pragma once
 
+#include <inttypes.h>
+
 #ifdef ROO_TESTING
 #include "roo_testing/buses/onewire/OneWire.h"
 #include "roo_testing/buses/onewire/fake_onewire.h"
 #else
 #include "OneWire.h"
+#include "util/OneWire_direct_gpio.h"
 #endif
 
+#include "roo_onewire/bus_simulation.h"
+#include "roo_onewire/commands.h"
+
 namespace roo_onewire {
 
 #ifdef ROO_TESTING
-using Bus = ::FakeOneWire;
+using BusDriver = ::FakeOneWire;
+
+// Returns the fake bus attached to the specified pin. Fails if there is none.
+FakeOneWireInterface* FindFakeBus(uint8_t pin);
+#else
+using BusDriver = ::OneWire;
+#endif
+
+// Counters of the bus operations, useful for benchmarking and for comparing
+// communication strategies.
+struct BusStats {
+  BusStats()
+      : resets(0),
+        presence_failures(0),
+        searches(0),
+        slots(0),
+        bytes_written(0),
+        bytes_read(0),
+        overdrive_slots(0),
+        bus_time_micros(0) {}
+
+  // Number of reset pulses.
+  uint32_t resets;
+
+  // Number of reset pulses that were not answered with a presence pulse.
+  uint32_t presence_failures;
+
+  // Number of search() calls (each yielding at most one device).
+  uint32_t searches;
+
+  // Number of read and write time slots (i.e., bits transferred), including
+  // those of ROM commands and searches.
+  uint32_t slots;
+
+  // Number of bytes written and read. (Bits transferred individually, or as
+  // part of a search, are not included.)
+  uint32_t bytes_written;
+  uint32_t bytes_read;
+
+  // Number of the time slots (included in `slots`) at overdrive speed.
+  uint32_t overdrive_slots;
+
+  // Estimated time spent communicating (see BusTiming).
+  int64_t bus_time_micros;
+
+  BusStats& operator+=(const BusStats& other) {
+    resets += other.resets;
+    presence_failures += other.presence_failures;
+    searches += other.searches;
+    slots += other.slots;
+    bytes_written += other.bytes_written;
+    bytes_read += other.bytes_read;
+    overdrive_slots += other.overdrive_slots;
+    bus_time_micros += other.bus_time_micros;
+    return *this;
+  }
+
+  // Returns the operations performed between two snapshots, `*this` being
+  // the later one.
+  BusStats operator-(const BusStats& earlier) const {
+    BusStats result;
+    result.resets = resets - earlier.resets;
+    result.presence_failures = presence_failures - earlier.presence_failures;
+    result.searches = searches - earlier.searches;
+    result.slots = slots - earlier.slots;
+    result.bytes_written = bytes_written - earlier.bytes_written;
+    result.bytes_read = bytes_read - earlier.bytes_read;
+    result.overdrive_slots = overdrive_slots - earlier.overdrive_slots;
+    result.bus_time_micros = bus_time_micros - earlier.bus_time_micros;
+    return result;
+  }
+};
+
+// The OneWire bus driver, instrumented to count bus operations, and extended
+// with overdrive speed (supported by DS28EA00; see overdriveSkip() and
+// overdriveSelect()).
+//
+// Under roo_testing, the fake bus does not model overdrive; the overdrive ROM
+// commands are sent as their standard equivalents (Skip ROM and Match ROM),
+// and the time is accounted at overdrive speed.
+class Bus : public BusDriver {
+ public:
+#ifdef ROO_TESTING
+  Bus(FakeOneWireInterface* bus)
+      : BusDriver(bus),
+        overdrive_(false),
+        presence_failure_(false),
+        function_command_(false),
+        command_(0),
+        response_pos_(0),
+        simulation_(nullptr) {}
+#else
+  Bus(uint8_t pin)
+      : BusDriver(pin),
+        bitmask_(PIN_TO_BITMASK(pin)),
+        base_reg_(PIN_TO_BASEREG(pin)),
+        overdrive_(false),
+        presence_failure_(false),
+        function_command_(false),
+        command_(0),
+        response_pos_(0),
+        simulation_(nullptr) {}
+#endif
+
+  // Standard-speed reset, which also returns all devices to standard speed.
+  uint8_t reset() {
+    busActivity();
+    overdrive_ = false;
+    command_ = 0;
+    ++stats_.resets;
+    elapse(BusTiming::kResetMicros);
+    uint8_t result = BusDriver::reset();
+    if (result && simulation_ != nullptr && simulation_->failPresence()) {
+      result = 0;
+    }
+    if (!result) presenceFailed();
+    return result;
+  }
+
+  // Overdrive-speed reset. Keeps the devices that are in overdrive there.
+  // Must only be called while in overdrive.
+  uint8_t overdriveReset() {
+    busActivity();
+    command_ = 0;
+    ++stats_.resets;
+    elapse(BusTiming::kOverdriveResetMicros);
+    uint8_t result = overdriveResetPulse();
+    if (result && simulation_ != nullptr && simulation_->failPresence()) {
+      result = 0;
+    }
+    if (!result) presenceFailed();
+    return result;
+  }
+
+  // Returns true if a reset has not been answered with a presence pulse since
+  // the last call to clearPresenceFailure().
+  bool hasPresenceFailure() const { return presence_failure_; }
+
+  void clearPresenceFailure() { presence_failure_ = false; }
+
+  void select(const uint8_t rom[8]) {
+    if (overdrive_) {
+      write(kMatchRom);
+      for (int i = 0; i < 8; ++i) write(rom[i]);
+    } else {
+      busActivity();
+      countWrite(9);
+      BusDriver::select(rom);
+    }
+    function_command_ = true;
+  }
+
+  void skip() {
+    if (overdrive_) {
+      write(kSkipRom);
+    } else {
+      busActivity();
+      countWrite(1);
+      BusDriver::skip();
+    }
+    function_command_ = true;
+  }
+
+  // Overdrive Skip ROM: switches all overdrive-capable devices to overdrive
+  // speed, and addresses them. Must follow a standard-speed reset. The bus
+  // remains in overdrive until the next reset().
+  void overdriveSkip() {
+    busActivity();
+    countWrite(1);
+#ifdef ROO_TESTING
+    BusDriver::skip();
+#else
+    BusDriver::write(kOverdriveSkipRom);
+#endif
+    overdrive_ = true;
+    function_command_ = true;
+  }
+
+  // Overdrive Match ROM: switches the specified device to overdrive speed,
+  // and addresses it. The rom code itself is sent at overdrive speed. Must
+  // follow a standard-speed reset. The bus remains in overdrive until the
+  // next reset().
+  void overdriveSelect(const uint8_t rom[8]) {
+    busActivity();
+    countWrite(1);
+#ifdef ROO_TESTING
+    BusDriver::select(rom);
+    overdrive_ = true;
+    countOverdriveSlots(64);
+    stats_.bytes_written += 8;
+#else
+    BusDriver::write(kOverdriveMatchRom);
+    overdrive_ = true;
+    for (int i = 0; i < 8; ++i) write(rom[i]);
+#endif
+    function_command_ = true;
+  }
+
+  bool isOverdrive() const { return overdrive_; }
+
+  void write(uint8_t v, uint8_t power = 0) {
+    bool function_command = function_command_;
+    busActivity();
+    if (overdrive_) {
+      stats_.bytes_written += 1;
+      countOverdriveSlots(8);
+      overdriveWrite(v, power);
+    } else {
+      countWrite(1);
+      BusDriver::write(v, power);
+    }
+    if (function_command) {
+      command_ = v;
+      response_pos_ = 0;
+    }
+    if (simulation_ == nullptr) return;
+    if (function_command && v == kConvert) simulation_->startConversion();
+    if (power) simulation_->beginPullUp();
+  }
+
+  uint8_t read() {
+    busActivity();
+    uint8_t result;
+    if (overdrive_) {
+      stats_.bytes_read += 1;
+      countOverdriveSlots(8);
+      result = overdriveRead();
+    } else {
+      countRead(1);
+      result = BusDriver::read();
+    }
+    if (simulation_ == nullptr) return result;
+    if (command_ == kReadScratchpad) {
+      result = simulation_->scratchpadByte(response_pos_++, result);
+    }
+    return simulation_->corrupt(result, 8, overdrive_);
+  }
+
+  void write_bit(uint8_t v) {
+    busActivity();
+    if (overdrive_) {
+      countOverdriveSlots(1);
+      overdriveWriteBit(v);
+      return;
+    }
+    countSlots(1);
+    BusDriver::write_bit(v);
+  }
+
+  uint8_t read_bit() {
+    busActivity();
+    uint8_t result;
+    if (overdrive_) {
+      countOverdriveSlots(1);
+      result = overdriveReadBit();
+    } else {
+      countSlots(1);
+      result = BusDriver::read_bit();
+    }
+    if (simulation_ == nullptr) return result;
+    // A converting device answers read slots with 0, and so does a
+    // parasite-powered one, asked for its power supply.
+    if (simulation_->isConverting() ||
+        (command_ == kReadPowerSupply && simulation_->isParasitePowered())) {
+      result = 0;
+    }
+    return simulation_->corrupt(result, 1, overdrive_);
+  }
+
+  // Turns the strong pull-up back on (e.g. after polling a parasite-powered
+  // conversion), until the next bus operation. Under roo_testing, only the
+  // simulation (if attached) sees it.
+  void power() {
+    busActivity();
+#ifndef ROO_TESTING
+    strongPullUp();
+#endif
+    if (simulation_ != nullptr) simulation_->beginPullUp();
+  }
+
+  // Turns off the strong pull-up.
+  void depower() {
+    busActivity();
+    BusDriver::depower();
+  }
+
+  // Each search involves a reset, the search command, and three time slots
+  // per rom code bit. (The counts are approximate, since the final, failed
+  // search may terminate early.)
+  bool search(uint8_t* addr, bool search_mode = true) {
+    busActivity();
+    overdrive_ = false;
+    command_ = 0;
+    ++stats_.searches;
+    ++stats_.resets;
+    elapse(BusTiming::kResetMicros);
+    countSlots(8 + 64 * 3);
+    return BusDriver::search(addr, search_mode);
+  }
+
+  const BusStats& stats() const { return stats_; }
+
+  void resetStats() { stats_ = BusStats(); }
+
+  // Attaches a timing and reliability model (or detaches it, if nullptr).
+  // Intended for testing and capacity planning with the fake bus.
+  void setSimulation(BusSimulation* simulation) { simulation_ = simulation; }
+
+ private:
+#ifdef ROO_TESTING
+  uint8_t overdriveResetPulse() { return BusDriver::reset(); }
+
+  void overdriveWrite(uint8_t v, uint8_t power) { BusDriver::write(v, power); }
+
+  uint8_t overdriveRead() { return BusDriver::read(); }
+
+  void overdriveWriteBit(uint8_t v) { BusDriver::write_bit(v); }
+
+  uint8_t overdriveReadBit() { return BusDriver::read_bit(); }
 #else
-using Bus = ::OneWire;
+  // Overdrive timings (Maxim AN126), with the delays rounded to whole
+  // microseconds.
+
+  uint8_t overdriveResetPulse() {
+    noInterrupts();
+    DIRECT_WRITE_LOW(base_reg_, bitmask_);
+    DIRECT_MODE_OUTPUT(base_reg_, bitmask_);
+    interrupts();
+    delayMicroseconds(70);
+    noInterrupts();
+    DIRECT_MODE_INPUT(base_reg_, bitmask_);
+    delayMicroseconds(8);
+    uint8_t result = !DIRECT_READ(base_reg_, bitmask_);
+    interrupts();
+    delayMicroseconds(40);
+    return result;
+  }
+
+  void overdriveWrite(uint8_t v, uint8_t power) {
+    for (uint8_t mask = 0x01; mask != 0; mask <<= 1) {
+      overdriveWriteBit((v & mask) ? 1 : 0);
+    }
+    if (power) strongPullUp();
+  }
+
+  // Drives the bus high, until the next bus operation.
+  void strongPullUp() {
+    noInterrupts();
+    DIRECT_WRITE_HIGH(base_reg_, bitmask_);
+    DIRECT_MODE_OUTPUT(base_reg_, bitmask_);
+    interrupts();
+  }
+
+  uint8_t overdriveRead() {
+    uint8_t result = 0;
+    for (uint8_t mask = 0x01; mask != 0; mask <<= 1) {
+      if (overdriveReadBit()) result |= mask;
+    }
+    return result;
+  }
+
+  void overdriveWriteBit(uint8_t v) {
+    noInterrupts();
+    DIRECT_WRITE_LOW(base_reg_, bitmask_);
+    DIRECT_MODE_OUTPUT(base_reg_, bitmask_);
+    if (v & 1) {
+      delayMicroseconds(1);
+      DIRECT_MODE_INPUT(base_reg_, bitmask_);
+      interrupts();
+      delayMicroseconds(8);
+    } else {
+      delayMicroseconds(8);
+      DIRECT_MODE_INPUT(base_reg_, bitmask_);
+      interrupts();
+      delayMicroseconds(2);
+    }
+  }
+
+  uint8_t overdriveReadBit() {
+    noInterrupts();
+    DIRECT_WRITE_LOW(base_reg_, bitmask_);
+    DIRECT_MODE_OUTPUT(base_reg_, bitmask_);
+    delayMicroseconds(1);
+    DIRECT_MODE_INPUT(base_reg_, bitmask_);
+    delayMicroseconds(1);
+    uint8_t result = DIRECT_READ(base_reg_, bitmask_);
+    interrupts();
+    delayMicroseconds(7);
+    return result;
+  }
+#endif
+
+  // Called before every bus operation, which (in particular) ends the strong
+  // pull-up, if on.
+  void busActivity() {
+    function_command_ = false;
+    if (simulation_ != nullptr) simulation_->endPullUp();
+  }
+
+  void presenceFailed() {
+    ++stats_.presence_failures;
+    presence_failure_ = true;
+  }
+
+  void countOverdriveSlots(int slots) {
+    stats_.slots += slots;
+    stats_.overdrive_slots += slots;
+    elapse(slots * BusTiming::kOverdriveSlotMicros);
+  }
+
+  void countWrite(int bytes) {
+    stats_.bytes_written += bytes;
+    countSlots(8 * bytes);
+  }
+
+  void countRead(int bytes) {
+    stats_.bytes_read += bytes;
+    countSlots(8 * bytes);
+  }
+
+  void countSlots(int slots) {
+    stats_.slots += slots;
+    elapse(slots * BusTiming::kSlotMicros);
+  }
+
+  void elapse(int32_t micros) {
+    stats_.bus_time_micros += micros;
+    if (simulation_ != nullptr) simulation_->elapse(micros);
+  }
+
+#ifndef ROO_TESTING
+  IO_REG_TYPE bitmask_;
+  volatile IO_REG_TYPE* base_reg_;
 #endif
 
+  // Whether the bus is at overdrive speed.
+  bool overdrive_;
+
+  // See hasPresenceFailure().
+  bool presence_failure_;
+
+  // Whether a ROM command has just been sent, so that the next byte written
+  // is a function command. Lets the simulation recognize conversions.
+  bool function_command_;
+
+  // The function command sent since the last reset, or 0 if none. Lets the
+  // simulation answer it.
+  uint8_t command_;
+
+  // Number of bytes read in response to command_.
+  int response_pos_;
+
+  BusStats stats_;
+  BusSimulation* simulation_;
+};
+
 }  // namespace roo_onewire
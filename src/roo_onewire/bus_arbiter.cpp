@@ -0,0 +1,87 @@
+#include "roo_onewire/bus_arbiter.h"
+
+#include "roo_logging.h"
+
+namespace roo_onewire {
+
+BusArbiter::BusArbiter(Bus& bus)
+    : bus_(bus), owner_(), depth_(0), held_for_conversion_(false) {
+  for (int& waiting : waiting_) waiting = 0;
+}
+
+bool BusArbiter::mayAcquire(Priority priority) const {
+  if (depth_ > 0 || held_for_conversion_) return false;
+  for (int p = priority + 1; p <= PRIORITY_HIGH; ++p) {
+    if (waiting_[p] > 0) return false;
+  }
+  return true;
+}
+
+void BusArbiter::acquire(Priority priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (depth_ > 0 && owner_ == std::this_thread::get_id()) {
+    // Waiting for the hold to end would never return.
+    CHECK(!held_for_conversion_)
+        << "Bus acquired from within the transaction that holds it for a "
+           "conversion; use tryAcquire()";
+    ++depth_;
+    return;
+  }
+  ++waiting_[priority];
+  released_.wait(lock, [this, priority]() { return mayAcquire(priority); });
+  --waiting_[priority];
+  owner_ = std::this_thread::get_id();
+  depth_ = 1;
+}
+
+bool BusArbiter::tryAcquire(Priority priority) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (held_for_conversion_) return false;
+  if (depth_ > 0) {
+    if (owner_ != std::this_thread::get_id()) return false;
+    ++depth_;
+    return true;
+  }
+  if (!mayAcquire(priority)) return false;
+  owner_ = std::this_thread::get_id();
+  depth_ = 1;
+  return true;
+}
+
+void BusArbiter::release() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK_GT(depth_, 0) << "Bus released without being acquired";
+  CHECK(owner_ == std::this_thread::get_id())
+      << "Bus released by a thread that does not hold it";
+  if (--depth_ > 0) return;
+  owner_ = std::thread::id();
+  lock.unlock();
+  released_.notify_all();
+}
+
+bool BusArbiter::isBusy() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return depth_ > 0 || held_for_conversion_;
+}
+
+void BusArbiter::holdForConversion() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  CHECK(depth_ > 0 && owner_ == std::this_thread::get_id())
+      << "Bus held for a conversion outside of a transaction";
+  held_for_conversion_ = true;
+}
+
+void BusArbiter::endConversionHold() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!held_for_conversion_) return;
+  held_for_conversion_ = false;
+  lock.unlock();
+  released_.notify_all();
+}
+
+bool BusArbiter::isHeldForConversion() const {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return held_for_conversion_;
+}
+
+}  // namespace roo_onewire
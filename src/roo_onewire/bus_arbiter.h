@@ -0,0 +1,117 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "roo_onewire/bus.h"
+
+namespace roo_onewire {
+
+// Grants exclusive access to a bus, one transaction at a time, so that other
+// 1-Wire drivers (e.g. for DS2408 or DS2413 switches) can share the pin with
+// roo_onewire::OneWire.
+//
+// A transaction is a sequence of bus operations that must not be interleaved
+// with others; it should begin with a reset, and leave the bus idle. The
+// thermometers use separate transactions for starting a conversion and for
+// reading the results, and release the bus in between, so that other drivers
+// can use it while the conversion is in progress. (The exception is the
+// parasite-powered bus, where the strong pull-up must be held for the
+// duration of the conversion; there, the bus is held for the conversion (see
+// holdForConversion()) until it completes, and nobody, on any thread, can
+// take it in the meantime.)
+//
+// When the bus is released, the waiting transaction with the highest
+// priority goes next. Transactions are re-entrant within a thread, except
+// while the bus is held for a conversion.
+//
+// Example:
+//
+//   {
+//     BusArbiter::Transaction transaction(onewire.arbiter(),
+//                                         BusArbiter::PRIORITY_HIGH);
+//     Bus& bus = transaction.bus();
+//     bus.reset();
+//     bus.select(switch_address);
+//     ...
+//   }
+class BusArbiter {
+ public:
+  enum Priority {
+    PRIORITY_LOW = 0,
+    PRIORITY_NORMAL = 1,  // Used by the thermometers.
+    PRIORITY_HIGH = 2,
+  };
+
+  // Holds the bus for the lifetime of the object.
+  class Transaction {
+   public:
+    Transaction(BusArbiter& arbiter, Priority priority = PRIORITY_NORMAL)
+        : arbiter_(arbiter) {
+      arbiter_.acquire(priority);
+    }
+
+    ~Transaction() { arbiter_.release(); }
+
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    Bus& bus() { return arbiter_.bus_; }
+
+   private:
+    BusArbiter& arbiter_;
+  };
+
+  explicit BusArbiter(Bus& bus);
+
+  // Blocks until the bus is available, and takes it. Each call must be
+  // matched with release(). Must not be called from the thread that
+  // completes a conversion while the bus is held for it (e.g. from a task
+  // of the same single-threaded scheduler), since it would never return;
+  // such callers should use tryAcquire(), and retry later.
+  void acquire(Priority priority = PRIORITY_NORMAL);
+
+  // Takes the bus if it is available immediately, and no transaction of
+  // higher priority is waiting. Returns true on success, in which case the
+  // call must be matched with release().
+  bool tryAcquire(Priority priority = PRIORITY_NORMAL);
+
+  void release();
+
+  // Returns true if the bus has been taken (by any thread), or is held for a
+  // conversion.
+  bool isBusy() const;
+
+  // Keeps the bus from being taken until endConversionHold(), regardless of
+  // the thread, and including re-entrant transactions. Must be called from
+  // within a transaction.
+  void holdForConversion();
+
+  // Ends the hold. May be called from any thread.
+  void endConversionHold();
+
+  bool isHeldForConversion() const;
+
+ private:
+  // Returns true if the calling thread may take the bus now. Must be called
+  // with mutex_ held.
+  bool mayAcquire(Priority priority) const;
+
+  Bus& bus_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable released_;
+
+  // The thread holding the bus, and the nesting depth.
+  std::thread::id owner_;
+  int depth_;
+
+  // See holdForConversion().
+  bool held_for_conversion_;
+
+  // Number of threads waiting, by priority.
+  int waiting_[PRIORITY_HIGH + 1];
+};
+
+}  // namespace roo_onewire
@@ -0,0 +1,142 @@
+#include "roo_onewire/bus_simulation.h"
+
+#include "roo_onewire/device_family.h"
+#include "roo_onewire/thermometers/conversion_time.h"
+#include "roo_time.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// Scratchpad of a DS18B20 that has not converted since power-on: 85 °C, and
+// the factory defaults.
+static const uint8_t kPowerOnScratchpad[9] = {0x50, 0x05, 0x4B, 0x46, 0x7F,
+                                              0xFF, 0x0C, 0x10, 0x1C};
+
+// A converting parasite-powered device rides out a single time slot without
+// the strong pull-up (e.g. a poll), on its internal capacitor; any longer,
+// and it browns out.
+static const int32_t kMaxUnpoweredMicros = BusTiming::kSlotMicros;
+
+uint32_t ProbabilityToThreshold(float p) {
+  if (p <= 0.0f) return 0;
+  if (p >= 1.0f) return 0xFFFFFFFF;
+  return (uint32_t)(p * 4294967295.0f);
+}
+
+}  // namespace
+
+BusSimulation::BusSimulation(const Options& options)
+    : clock_(options.clock),
+      conversion_micros_(
+          ConversionTimeMicros(DEVICE_FAMILY_DS18B20, options.resolution)),
+      parasite_power_(options.parasite_power),
+      random_state_(options.seed == 0 ? 1 : options.seed),
+      elapsed_micros_(0),
+      injected_bit_errors_(0),
+      injected_presence_failures_(0),
+      pending_power_on_resets_(0),
+      injected_power_on_resets_(0),
+      power_on_read_(false),
+      conversion_end_(0),
+      conversions_(0),
+      pulled_up_(false),
+      pull_up_start_(0),
+      pull_up_micros_(0),
+      unpowered_(false),
+      released_(0),
+      interrupted_conversions_(0) {
+  float ratio = options.cable_length_m / options.reference_length_m;
+  float factor = 1.0f + ratio * ratio * ratio * ratio;
+  bit_error_threshold_ =
+      ProbabilityToThreshold(options.base_bit_error_rate * factor);
+  overdrive_bit_error_threshold_ = ProbabilityToThreshold(
+      options.base_bit_error_rate * factor + options.overdrive_bit_error_rate);
+  presence_failure_threshold_ =
+      ProbabilityToThreshold(options.base_presence_failure_rate * factor);
+}
+
+void BusSimulation::elapse(int32_t micros) {
+  elapsed_micros_ += micros;
+  if (clock_ != nullptr) clock_->advance(micros);
+}
+
+void BusSimulation::startConversion() {
+  conversion_end_ = now() + conversion_micros_;
+  ++conversions_;
+}
+
+bool BusSimulation::isConverting() {
+  checkPower();
+  return now() < conversion_end_;
+}
+
+void BusSimulation::beginPullUp() {
+  checkPower();
+  unpowered_ = false;
+  pulled_up_ = true;
+  pull_up_start_ = now();
+}
+
+void BusSimulation::endPullUp() {
+  if (!pulled_up_) return;
+  pulled_up_ = false;
+  int64_t t = now();
+  pull_up_micros_ += t - pull_up_start_;
+  if (t < conversion_end_) {
+    unpowered_ = true;
+    released_ = t;
+  }
+}
+
+void BusSimulation::checkPower() {
+  if (!unpowered_ || now() - released_ <= kMaxUnpoweredMicros) return;
+  unpowered_ = false;
+  ++interrupted_conversions_;
+  // The device lost power; it does not complete the conversion.
+  conversion_end_ = released_;
+}
+
+bool BusSimulation::failPresence() {
+  if (!draw(presence_failure_threshold_)) return false;
+  ++injected_presence_failures_;
+  return true;
+}
+
+uint8_t BusSimulation::corrupt(uint8_t value, int bits, bool overdrive) {
+  uint32_t threshold =
+      overdrive ? overdrive_bit_error_threshold_ : bit_error_threshold_;
+  for (int i = 0; i < bits; ++i) {
+    if (draw(threshold)) {
+      value ^= (1 << i);
+      ++injected_bit_errors_;
+    }
+  }
+  return value;
+}
+
+uint8_t BusSimulation::scratchpadByte(int pos, uint8_t value) {
+  if (pos == 0) {
+    power_on_read_ = (pending_power_on_resets_ > 0);
+    if (power_on_read_) {
+      --pending_power_on_resets_;
+      ++injected_power_on_resets_;
+    }
+  }
+  return (power_on_read_ && pos < 9) ? kPowerOnScratchpad[pos] : value;
+}
+
+int64_t BusSimulation::now() {
+  if (clock_ != nullptr) return clock_->nowMicros();
+  return (roo_time::Uptime::Now() - roo_time::Uptime::Start()).inMicros();
+}
+
+bool BusSimulation::draw(uint32_t threshold) {
+  if (threshold == 0) return false;
+  random_state_ ^= random_state_ << 13;
+  random_state_ ^= random_state_ >> 17;
+  random_state_ ^= random_state_ << 5;
+  return random_state_ < threshold;
+}
+
+}  // namespace roo_onewire
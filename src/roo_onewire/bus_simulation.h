@@ -0,0 +1,212 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include "roo_onewire/thermometers/resolution.h"
+
+namespace roo_onewire {
+
+// Timing of bus operations (see Maxim AN126), used to estimate
+// the bus time consumed by the library.
+struct BusTiming {
+  // Reset pulse, followed by the presence detection window.
+  static constexpr int32_t kResetMicros = 960;
+
+  // A single read or write time slot, including recovery.
+  static constexpr int32_t kSlotMicros = 70;
+
+  // Same as above, at overdrive speed.
+  static constexpr int32_t kOverdriveResetMicros = 120;
+  static constexpr int32_t kOverdriveSlotMicros = 10;
+};
+
+// Wraps the (instantaneous) fake bus used in tests with a timing and
+// reliability model, so that cycle times and failure handling of large
+// installations can be studied off-device. When attached to a bus (see
+// Bus::setSimulation()), every bus operation advances the clock by its
+// duration, and reads and presence pulses fail randomly, at rates that grow
+// with the cable length.
+//
+// Temperature conversions take the datasheet time for the configured
+// resolution: until then, polling read slots return 0. The strong pull-up,
+// held after a write with power, is timed until the next bus operation;
+// releasing it before the conversion completes, for longer than a single
+// time slot, counts as an interrupted conversion (which, on a real
+// parasite-powered bus, browns the device out). A single poll slot is
+// bridged, as long as the pull-up is turned back on right after it.
+class BusSimulation {
+ public:
+  // Source of the simulated time. To simulate faster than real time, the
+  // implementation should drive the clock that the scheduler reads (e.g.
+  // the emulated clock, under roo_testing).
+  class Clock {
+   public:
+    virtual ~Clock() {}
+
+    // Returns the current time.
+    virtual int64_t nowMicros() = 0;
+
+    // Advances the time by the specified amount.
+    virtual void advance(int32_t micros) = 0;
+  };
+
+  struct Options {
+    Options()
+        : cable_length_m(10.0f),
+          reference_length_m(100.0f),
+          base_bit_error_rate(1e-7f),
+          base_presence_failure_rate(1e-5f),
+          overdrive_bit_error_rate(0.0f),
+          resolution(RESOLUTION_12_BITS),
+          parasite_power(false),
+          clock(nullptr),
+          seed(1) {}
+
+    // Total length of the bus cable.
+    float cable_length_m;
+
+    // Failure rates are multiplied by (1 + (length / reference)^4), i.e. they
+    // stay close to the base rates up to the reference length, and grow
+    // sharply beyond it.
+    float reference_length_m;
+
+    // Probability that any given read time slot returns a flipped bit.
+    float base_bit_error_rate;
+
+    // Probability that a device fails to answer a reset pulse.
+    float base_presence_failure_rate;
+
+    // Additional probability of a flipped bit, for read time slots at
+    // overdrive speed, whose timing tolerates far less cable capacitance.
+    // Models a bus too long for overdrive.
+    float overdrive_bit_error_rate;
+
+    // Resolution of the (DS18B20-like) thermometers on the bus, determining
+    // the conversion time.
+    Resolution resolution;
+
+    // Whether the thermometers draw their power from the data line. If so,
+    // they report it when asked (see Thermometers::isParasite()), so
+    // that the conversions are powered by the strong pull-up.
+    bool parasite_power;
+
+    // If nullptr, the bus time is only accounted, without advancing any
+    // clock, and the conversion and pull-up periods are measured using
+    // roo_time::Uptime::Now().
+    Clock* clock;
+
+    // Seed for the pseudo-random failure generator.
+    uint32_t seed;
+  };
+
+  BusSimulation() : BusSimulation(Options()) {}
+
+  BusSimulation(const Options& options);
+
+  // Accounts for the specified bus time.
+  void elapse(int32_t micros);
+
+  // Called when a Convert T command has been issued.
+  void startConversion();
+
+  // Returns true if the most recently started conversion is still in
+  // progress.
+  bool isConverting();
+
+  // Called when the strong pull-up is turned on, and when any subsequent bus
+  // operation turns it off. (Turning it off when it is not on is a no-op.)
+  void beginPullUp();
+  void endPullUp();
+
+  bool isParasitePowered() const { return parasite_power_; }
+
+  // Makes the next `count` scratchpad reads return the power-on reset value,
+  // as if the device had browned out (e.g. lost power during its
+  // conversion).
+  void injectPowerOnResets(int count) { pending_power_on_resets_ += count; }
+
+  // Called for each byte read in response to Read Scratchpad, with its
+  // position. Returns `value`, or the power-on reset value in its place.
+  uint8_t scratchpadByte(int pos, uint8_t value);
+
+  // Returns true if the presence pulse should be suppressed.
+  bool failPresence();
+
+  // Returns `value`, with `bits` least significant bits subject to random
+  // flips, read at standard or overdrive speed.
+  uint8_t corrupt(uint8_t value, int bits, bool overdrive);
+
+  // Total simulated bus time.
+  int64_t elapsedMicros() const { return elapsed_micros_; }
+
+  uint32_t injectedBitErrors() const { return injected_bit_errors_; }
+
+  uint32_t injectedPresenceFailures() const {
+    return injected_presence_failures_;
+  }
+
+  uint32_t injectedPowerOnResets() const { return injected_power_on_resets_; }
+
+  // Conversion time of the thermometers on the bus.
+  int32_t conversionMicros() const { return conversion_micros_; }
+
+  uint32_t conversions() const { return conversions_; }
+
+  // Total time the strong pull-up has been held.
+  int64_t pullUpMicros() const { return pull_up_micros_; }
+
+  // Number of times the strong pull-up has been released, for longer than a
+  // time slot, before the conversion completed. Accounted at the next bus
+  // operation, or isConverting().
+  uint32_t interruptedConversions() const { return interrupted_conversions_; }
+
+ private:
+  int64_t now();
+
+  // Ends the conversion if the strong pull-up has been released for too
+  // long.
+  void checkPower();
+
+  // Returns true with the specified probability, given as a 32-bit fixed
+  // point threshold.
+  bool draw(uint32_t threshold);
+
+  Clock* clock_;
+  int32_t conversion_micros_;
+  bool parasite_power_;
+
+  // Failure probabilities, scaled to 2^32.
+  uint32_t bit_error_threshold_;
+  uint32_t overdrive_bit_error_threshold_;
+  uint32_t presence_failure_threshold_;
+
+  // State of the xorshift32 generator.
+  uint32_t random_state_;
+
+  int64_t elapsed_micros_;
+  uint32_t injected_bit_errors_;
+  uint32_t injected_presence_failures_;
+
+  // See injectPowerOnResets().
+  int pending_power_on_resets_;
+  uint32_t injected_power_on_resets_;
+
+  // Whether the scratchpad being read is replaced by the power-on reset value.
+  bool power_on_read_;
+
+  // When the pending conversion completes.
+  int64_t conversion_end_;
+  uint32_t conversions_;
+
+  bool pulled_up_;
+  int64_t pull_up_start_;
+  int64_t pull_up_micros_;
+
+  // Whether the strong pull-up has been released during the conversion, and
+  // when.
+  bool unpowered_;
+  int64_t released_;
+  uint32_t interrupted_conversions_;
+};
+
+}  // namespace roo_onewire
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <inttypes.h>
+
+namespace roo_onewire {
+
+// ROM commands.
+static const uint8_t kReadRom = 0x33;
+static const uint8_t kMatchRom = 0x55;
+static const uint8_t kSkipRom = 0xCC;
+static const uint8_t kAlarmSearch = 0xEC;
+static const uint8_t kConditionalReadRom = 0x0F;  // DS28EA00 chain mode.
+static const uint8_t kOverdriveSkipRom = 0x3C;
+static const uint8_t kOverdriveMatchRom = 0x69;
+
+// Function commands (thermometers).
+static const uint8_t kConvert = 0x44;
+static const uint8_t kWriteScratchpad = 0x4E;
+static const uint8_t kReadScratchpad = 0xBE;
+static const uint8_t kCopyScratchpad = 0x48;
+static const uint8_t kRecallEEPROM = 0xB8;
+static const uint8_t kReadPowerSupply = 0xB4;
+
+// Chain mode (DS28EA00). The chain command is followed by the control byte,
+// its complement, and then the device responds with kChainAck.
+static const uint8_t kChain = 0x99;
+static const uint8_t kChainOff = 0x3C;
+static const uint8_t kChainOn = 0x5A;
+static const uint8_t kChainDone = 0x96;
+static const uint8_t kChainAck = 0xAA;
+
+}  // namespace roo_onewire
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Dallas/Maxim CRC8 (polynomial x^8 + x^5 + x^4 + 1), used to validate rom
+// codes and scratchpad contents.
+//
+// Several implementations are available, trading speed for flash footprint.
+// The one used by the library is selected at compile time, by defining
+// ROO_ONEWIRE_CRC8 as one of the values below. (See the crc8_benchmark
+// example to compare them on your hardware.)
+
+// Bit-by-bit; no tables.
+#define ROO_ONEWIRE_CRC8_BITWISE 0
+
+// Nibble-at-a-time, using a 16-byte table.
+#define ROO_ONEWIRE_CRC8_NIBBLE 1
+
+// Byte-at-a-time, using a 256-byte table.
+#define ROO_ONEWIRE_CRC8_TABLE 2
+
+#ifndef ROO_ONEWIRE_CRC8
+#define ROO_ONEWIRE_CRC8 ROO_ONEWIRE_CRC8_NIBBLE
+#endif
+
+namespace roo_onewire {
+
+uint8_t Crc8Bitwise(const uint8_t* data, size_t len, uint8_t crc = 0);
+uint8_t Crc8Nibble(const uint8_t* data, size_t len, uint8_t crc = 0);
+uint8_t Crc8Table(const uint8_t* data, size_t len, uint8_t crc = 0);
+
+// Computes the CRC8 of the 7 lowest bytes (family code and serial number) of
+// the rom code packed into a 64-bit integer, without unpacking it into bytes.
+// The rom code is valid if the result equals the highest byte.
+uint8_t RomCodeCrc8Bitwise(uint64_t rom_code);
+uint8_t RomCodeCrc8Nibble(uint64_t rom_code);
+uint8_t RomCodeCrc8Table(uint64_t rom_code);
+
+// Computes the CRC8 using the implementation selected via ROO_ONEWIRE_CRC8.
+inline uint8_t Crc8(const uint8_t* data, size_t len) {
+#if ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_BITWISE
+  return Crc8Bitwise(data, len);
+#elif ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_NIBBLE
+  return Crc8Nibble(data, len);
+#elif ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_TABLE
+  return Crc8Table(data, len);
+#else
+#error "Unsupported value of ROO_ONEWIRE_CRC8"
+#endif
+}
+
+// Computes the rom code CRC8 using the implementation selected via
+// ROO_ONEWIRE_CRC8.
+inline uint8_t RomCodeCrc8(uint64_t rom_code) {
+#if ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_BITWISE
+  return RomCodeCrc8Bitwise(rom_code);
+#elif ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_NIBBLE
+  return RomCodeCrc8Nibble(rom_code);
+#elif ROO_ONEWIRE_CRC8 == ROO_ONEWIRE_CRC8_TABLE
+  return RomCodeCrc8Table(rom_code);
+#else
+#error "Unsupported value of ROO_ONEWIRE_CRC8"
+#endif
+}
+
+}  // namespace roo_onewire
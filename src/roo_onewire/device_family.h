@@ -1,5 +1,7 @@
 #pragma once
 
+#include <inttypes.h>
+
 #include "roo_logging.h"
 
 namespace roo_onewire {
@@ -15,6 +17,19 @@ enum DeviceFamily {
   DEVICE_FAMILY_BROADCAST,
 };
 
+// Returns the device family corresponding to the specified family code (the
+// lowest byte of the rom code). Family code 0x3B is shared by DS1825 and
+// MAX31850; this function assumes DS1825. Returns DEVICE_FAMILY_UNKNOWN for
+// unsupported family codes.
+constexpr DeviceFamily DefaultDeviceFamily(uint8_t family_code) {
+  return family_code == 0x10   ? DEVICE_FAMILY_DS18S20
+         : family_code == 0x28 ? DEVICE_FAMILY_DS18B20
+         : family_code == 0x22 ? DEVICE_FAMILY_DS1822
+         : family_code == 0x3B ? DEVICE_FAMILY_DS1825
+         : family_code == 0x42 ? DEVICE_FAMILY_DS28EA00
+                               : DEVICE_FAMILY_UNKNOWN;
+}
+
 roo_logging::Stream& operator<<(roo_logging::Stream& os, DeviceFamily family);
 
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "roo_onewire/rom_code.h"
 
+#include "roo_onewire/crc8.h"
+
 namespace roo_onewire {
 
 namespace {
@@ -11,9 +13,7 @@ inline char NibbleToChar(uint8_t nibble) {
 }  // namespace
 
 bool RomCode::isValidUnicast() const {
-  OneWireDeviceAddress addr;
-  toOneWireDeviceAddress(addr);
-  return OneWire::crc8(addr, 7) == addr[7];
+  return RomCodeCrc8(rom_code_) == (uint8_t)(rom_code_ >> 56);
 }
 
 String RomCode::toString() const {
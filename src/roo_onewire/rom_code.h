@@ -20,6 +20,9 @@
 
 namespace roo_onewire {
 
+template <typename... Devices>
+class StaticOneWire;
+
 using OneWireDeviceAddress = uint8_t[8];
 
 // Identifies a device on the bus. Can be passed by value.
@@ -58,6 +61,9 @@ class RomCode {
   friend class Thermometers;
   friend struct RomCodeHashFn;
 
+  template <typename... Devices>
+  friend class StaticOneWire;
+
   friend class BusMaster;
 
   RomCode(const OneWireDeviceAddress &addr);
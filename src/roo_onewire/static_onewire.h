@@ -0,0 +1,374 @@
+#pragma once
+
+// Support for fixed installations, where the set of thermometers is known at
+// compile time. The rom codes, families, and resolutions are compile-time
+// constants; there is no discovery, and no heap allocation. Conversion delays
+// and the rom code lookup are computed at compile time.
+//
+// Example:
+//
+//   using Kitchen = StaticThermometer<0x6B0000000ABCDE28>;
+//   using Attic = StaticThermometer<0x3D0000000ABCDF28, RESOLUTION_10_BITS>;
+//
+//   StaticOneWire<Kitchen, Attic> onewire(kPin, scheduler);
+//
+//   ...
+//   onewire.update();
+//   ...
+//   onewire.thermometer(0).temperature();
+
+#include <inttypes.h>
+
+#include "roo_logging.h"
+#include "roo_onewire/bus.h"
+#include "roo_onewire/commands.h"
+#include "roo_onewire/device_family.h"
+#include "roo_onewire/rom_code.h"
+#include "roo_onewire/thermometers.h"
+#include "roo_onewire/thermometers/conversion_time.h"
+#include "roo_onewire/thermometers/resolution.h"
+#include "roo_onewire/thermometers/thermometer.h"
+#include "roo_onewire/wakeup.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+namespace roo_onewire {
+
+// Compile-time description of a thermometer on a static bus. The family is
+// deduced from the rom code; it only needs to be specified explicitly for
+// MAX31850 (which shares the family code with DS1825).
+template <uint64_t rom_code, Resolution resolution = RESOLUTION_12_BITS,
+          DeviceFamily family = DefaultDeviceFamily(rom_code & 0xFF)>
+struct StaticThermometer {
+  static_assert(family != DEVICE_FAMILY_UNKNOWN &&
+                    family != DEVICE_FAMILY_BROADCAST,
+                "Unsupported thermometer family");
+
+  static constexpr uint64_t kRomCode = rom_code;
+  static constexpr DeviceFamily kFamily = family;
+  static constexpr Resolution kResolution =
+      family == DEVICE_FAMILY_DS18S20    ? RESOLUTION_9_BITS
+      : family == DEVICE_FAMILY_MAX31850 ? RESOLUTION_14_BITS
+                                         : resolution;
+  static constexpr int32_t kConversionTimeMicros =
+      ConversionTimeMicros(family, resolution);
+};
+
+namespace internal {
+
+constexpr int32_t MaxOf(int32_t a) { return a; }
+
+template <typename... Rest>
+constexpr int32_t MaxOf(int32_t a, int32_t b, Rest... rest) {
+  return MaxOf(a > b ? a : b, rest...);
+}
+
+// Multiplicative hashing of rom codes into a table of 2^bits slots.
+
+constexpr uint32_t FoldRomCode(uint64_t code) {
+  return (uint32_t)(code ^ (code >> 32));
+}
+
+constexpr uint32_t RomCodeSlot(uint64_t code, uint32_t multiplier, int bits) {
+  return (FoldRomCode(code) * multiplier) >> (32 - bits);
+}
+
+// Returns an (odd) candidate multiplier.
+constexpr uint32_t CandidateMultiplier(int attempt) {
+  return 0x9E3779B1u + 0xFEA3A9EAu * (uint32_t)attempt;
+}
+
+// Smallest number of bits such that the table has at least n^2 slots (which
+// makes a collision-free multiplier easy to find), capped at 10.
+constexpr int PerfectHashBits(int n, int bits = 1) {
+  return (bits >= 10 || (1 << bits) >= n * n) ? bits
+                                              : PerfectHashBits(n, bits + 1);
+}
+
+constexpr bool SlotUnique(const uint64_t* codes, int n, int i, int j,
+                          uint32_t multiplier, int bits) {
+  return j >= n ? true
+                : RomCodeSlot(codes[i], multiplier, bits) !=
+                          RomCodeSlot(codes[j], multiplier, bits) &&
+                      SlotUnique(codes, n, i, j + 1, multiplier, bits);
+}
+
+constexpr bool AllSlotsUnique(const uint64_t* codes, int n, int i,
+                              uint32_t multiplier, int bits) {
+  return i >= n ? true
+                : SlotUnique(codes, n, i, i + 1, multiplier, bits) &&
+                      AllSlotsUnique(codes, n, i + 1, multiplier, bits);
+}
+
+// Returns a multiplier that maps all the codes to distinct slots, or zero if
+// none has been found.
+constexpr uint32_t FindPerfectHashMultiplier(const uint64_t* codes, int n,
+                                             int bits, int attempt = 0) {
+  return attempt >= 64 ? 0
+         : AllSlotsUnique(codes, n, 0, CandidateMultiplier(attempt), bits)
+             ? CandidateMultiplier(attempt)
+             : FindPerfectHashMultiplier(codes, n, bits, attempt + 1);
+}
+
+}  // namespace internal
+
+// A OneWire bus with a fixed, compile-time set of thermometers. See the
+// comment at the top of the file.
+template <typename... Devices>
+class StaticOneWire {
+ public:
+  static constexpr int kCount = sizeof...(Devices);
+
+  static_assert(kCount > 0, "At least one thermometer is required");
+  static_assert(kCount <= 127, "Too many thermometers");
+
+  // Maximum number of event listeners.
+  static constexpr int kMaxEventListeners = 4;
+
+  // Time to wait for the conversion, determined by the slowest device.
+  static constexpr int32_t kConversionTimeMicros =
+      internal::MaxOf(Devices::kConversionTimeMicros...);
+
+  StaticOneWire(uint8_t pin, roo_scheduler::Scheduler& scheduler)
+#ifdef ROO_TESTING
+      : bus_(FindFakeBus(pin)),
+#else
+      : bus_(pin),
+#endif
+        parasite_(false),
+        power_supply_known_(false),
+        last_completed_conversion_(roo_time::Uptime::Start()),
+        pending_conversion_(roo_time::Uptime::Start()),
+        conversion_completion_task_(scheduler,
+                                    [this]() { conversionCompleted(); }),
+        listener_count_(0) {
+    const DeviceFamily families[] = {Devices::kFamily...};
+    const Resolution resolutions[] = {Devices::kResolution...};
+    for (int i = 0; i < kCount; ++i) {
+      thermometers_[i].set(RomCode(kRomCodes[i]), families[i], resolutions[i],
+                           0, kUnknownRawTemperature);
+      present_[i] = true;
+    }
+    for (int i = 0; i < (1 << kHashBits); ++i) {
+      slots_[i] = -1;
+    }
+    if (kHashMultiplier != 0) {
+      for (int i = 0; i < kCount; ++i) {
+        slots_[internal::RomCodeSlot(kRomCodes[i], kHashMultiplier,
+                                     kHashBits)] = i;
+      }
+    }
+  }
+
+  int count() const { return kCount; }
+
+  bool isParasite() const { return parasite_; }
+
+  // Returns the ith thermometer, in the order of the template arguments.
+  const Thermometer& thermometer(int idx) const { return thermometers_[idx]; }
+
+  RomCode rom_code(int idx) const { return RomCode(kRomCodes[idx]); }
+
+  // Returns the index of the thermometer with the specified rom code, or -1
+  // if the rom code is not one of the configured ones.
+  int indexOf(RomCode rom_code) const {
+    if (kHashMultiplier == 0) {
+      for (int i = 0; i < kCount; ++i) {
+        if (kRomCodes[i] == rom_code.raw()) return i;
+      }
+      return -1;
+    }
+    int idx = slots_[internal::RomCodeSlot(rom_code.raw(), kHashMultiplier,
+                                           kHashBits)];
+    return (idx >= 0 && kRomCodes[idx] == rom_code.raw()) ? idx : -1;
+  }
+
+  const Thermometer* thermometerByRomCode(RomCode rom_code) const {
+    int idx = indexOf(rom_code);
+    return idx < 0 ? nullptr : &thermometers_[idx];
+  }
+
+  // Sets the calibration to apply to the readings of the ith thermometer.
+  // Takes effect with the next conversion.
+  void setCalibration(int idx, const Calibration& calibration) {
+    thermometers_[idx].setCalibration(calibration);
+  }
+
+  // Returns false if the most recent call to verifyPresence() failed to
+  // communicate with the specified thermometer. Thermometers are assumed to
+  // be present until verified otherwise.
+  bool isPresent(int idx) const { return present_[idx]; }
+
+  // Checks that all configured thermometers are present on the bus, by
+  // reading their scratchpads, and applies the configured resolution to those
+  // thermometers whose current setting differs (without writing it to
+  // EEPROM). Also detects whether the bus uses parasite power. Optional;
+  // returns true if all thermometers have been found.
+  bool verifyPresence() {
+    readPowerSupply();
+    bool all_present = true;
+    for (int i = 0; i < kCount; ++i) {
+      Thermometer& t = thermometers_[i];
+      Scratchpad scratchpad;
+      present_[i] =
+          Thermometers::readScratchpad(bus_, t.rom_code(), scratchpad);
+      if (!present_[i]) {
+        LOG(ERROR) << "Thermometer " << t.rom_code() << " not found";
+        all_present = false;
+        continue;
+      }
+      Thermometer actual;
+      if (!Thermometers::initThermometer(t.rom_code(), scratchpad, actual,
+                                         /*post_conversion*/ false)) {
+        present_[i] = false;
+        all_present = false;
+        continue;
+      }
+      if (actual.family() != t.family()) {
+        LOG(WARNING) << "Thermometer " << t.rom_code() << " is "
+                     << actual.family() << ", expected " << t.family();
+      }
+      if (actual.resolution() != t.resolution()) {
+        writeResolution(t, scratchpad);
+      }
+      t.set(t.rom_code(), t.family(), t.resolution(), actual.user_bytes(),
+            t.raw_temperature());
+    }
+    return all_present;
+  }
+
+  // Requests temperature conversion. Returns true if the conversion request
+  // has been issued; false otherwise (e.g. if there is no device on the bus.)
+  // If the conversion is already in progress, immediately returns true.
+  bool update() {
+    if (isConversionPending()) return true;
+    if (!power_supply_known_) readPowerSupply();
+    if (!bus_.reset()) return false;
+    bus_.skip();
+    bus_.write(kConvert, parasite_);
+    roo_time::Interval delay = roo_time::Micros(kConversionTimeMicros);
+    conversion_completion_task_.scheduleAfter(delay);
+    pending_conversion_ = roo_time::Uptime::Now() + delay;
+    return true;
+  }
+
+  bool isConversionPending() const {
+    return pending_conversion_ != roo_time::Uptime::Start();
+  }
+
+  roo_time::Uptime getPendingConversionTime() const {
+    return pending_conversion_;
+  }
+
+  // Returns when the results of the pending conversion are to be read, along
+  // with an estimate of the bus time needed. See OneWire::nextWakeup().
+  Wakeup nextWakeup() const {
+    if (!isConversionPending()) return Wakeup();
+    return Wakeup(pending_conversion_,
+                  roo_time::Micros(kCount * (2 * BusTiming::kResetMicros +
+                                             (8 + 64 + 8 + 72) *
+                                                 BusTiming::kSlotMicros)));
+  }
+
+  roo_time::Uptime lastReadingTime() const {
+    return last_completed_conversion_;
+  }
+
+  // Registers a listener, to be notified when conversion completes. At most
+  // kMaxEventListeners can be registered.
+  void addEventListener(Thermometers::EventListener* listener) {
+    CHECK_LT(listener_count_, kMaxEventListeners)
+        << "Too many event listeners";
+    listeners_[listener_count_++] = listener;
+  }
+
+  void removeEventListener(Thermometers::EventListener* listener) {
+    for (int i = 0; i < listener_count_; ++i) {
+      if (listeners_[i] == listener) {
+        listeners_[i] = listeners_[--listener_count_];
+        return;
+      }
+    }
+  }
+
+  // Returns the counters of bus operations performed so far.
+  const BusStats& busStats() const { return bus_.stats(); }
+
+  // Zeroes the counters of bus operations.
+  void resetBusStats() { bus_.resetStats(); }
+
+  const Thermometer* begin() const { return thermometers_; }
+  const Thermometer* end() const { return thermometers_ + kCount; }
+
+ private:
+  static constexpr uint64_t kRomCodes[kCount] = {Devices::kRomCode...};
+
+  static constexpr int kHashBits = internal::PerfectHashBits(kCount);
+
+  // Zero if no perfect hash has been found; falls back to linear search.
+  static constexpr uint32_t kHashMultiplier =
+      internal::FindPerfectHashMultiplier(kRomCodes, kCount, kHashBits);
+
+  void readPowerSupply() {
+    bus_.reset();
+    bus_.skip();
+    bus_.write(kReadPowerSupply);
+    parasite_ = (bus_.read_bit() == 0);
+    bus_.reset();
+    power_supply_known_ = true;
+  }
+
+  void writeResolution(const Thermometer& t, const Scratchpad& scratchpad) {
+    if (t.family() == DEVICE_FAMILY_DS18S20 ||
+        t.family() == DEVICE_FAMILY_MAX31850) {
+      return;
+    }
+    OneWireDeviceAddress addr;
+    t.rom_code().toOneWireDeviceAddress(addr);
+    if (!bus_.reset()) return;
+    bus_.select(addr);
+    bus_.write(kWriteScratchpad);
+    bus_.write(scratchpad[2]);
+    bus_.write(scratchpad[3]);
+    bus_.write(((t.resolution() - 9) << 5) | 0x1F);
+    bus_.reset();
+  }
+
+  void conversionCompleted() {
+    last_completed_conversion_ = pending_conversion_;
+    pending_conversion_ = roo_time::Uptime::Start();
+    for (int i = 0; i < kCount; ++i) {
+      Thermometer& t = thermometers_[i];
+      Scratchpad scratchpad;
+      if (Thermometers::readScratchpad(bus_, t.rom_code(), scratchpad) &&
+          Thermometers::initThermometer(t.rom_code(), scratchpad, t,
+                                        /*post_conversion*/ true)) {
+        t.setReadingTime(last_completed_conversion_);
+      }
+    }
+    for (int i = 0; i < listener_count_; ++i) {
+      listeners_[i]->conversionCompleted();
+    }
+  }
+
+  Bus bus_;
+  bool parasite_;
+  bool power_supply_known_;
+  roo_time::Uptime last_completed_conversion_;
+  roo_time::Uptime pending_conversion_;
+  roo_scheduler::SingletonTask conversion_completion_task_;
+
+  Thermometer thermometers_[kCount];
+  bool present_[kCount];
+
+  // Maps hash slots to thermometer indexes; -1 for empty slots.
+  int8_t slots_[1 << kHashBits];
+
+  Thermometers::EventListener* listeners_[kMaxEventListeners];
+  int listener_count_;
+};
+
+template <typename... Devices>
+constexpr uint64_t StaticOneWire<Devices...>::kRomCodes[];
+
+}  // namespace roo_onewire
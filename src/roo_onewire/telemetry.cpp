@@ -0,0 +1,411 @@
+#include "roo_onewire/telemetry.h"
+
+#include <algorithm>
+
+#include "roo_onewire/thermometers/raw_temperature.h"
+
+using roo_time::Uptime;
+
+namespace roo_onewire {
+
+namespace {
+
+// CBOR major types.
+static const uint8_t kCborUnsigned = 0;
+static const uint8_t kCborNegative = 1;
+static const uint8_t kCborArray = 4;
+static const uint8_t kCborSimple = 7;
+
+// CBOR simple values.
+static const uint8_t kCborFalse = 20;
+static const uint8_t kCborTrue = 21;
+static const uint8_t kCborNull = 22;
+
+// Appends to a fixed buffer; once full, keeps counting but stops writing.
+class Output {
+ public:
+  Output(uint8_t* buf, size_t capacity)
+      : buf_(buf), capacity_(capacity), size_(0) {}
+
+  void put(uint8_t c) {
+    if (size_ < capacity_) buf_[size_] = c;
+    ++size_;
+  }
+
+  void put(const char* str) {
+    while (*str != 0) put((uint8_t)*str++);
+  }
+
+  void put(const char* str, size_t len) {
+    for (size_t i = 0; i < len; ++i) put((uint8_t)str[i]);
+  }
+
+  bool ok() const { return size_ <= capacity_; }
+
+  size_t size() const { return size_; }
+
+ private:
+  uint8_t* buf_;
+  size_t capacity_;
+  size_t size_;
+};
+
+void CborHead(Output& out, uint8_t major, uint64_t val) {
+  major <<= 5;
+  if (val < 24) {
+    out.put(major | val);
+    return;
+  }
+  int bytes;
+  if (val <= 0xFF) {
+    out.put(major | 24);
+    bytes = 1;
+  } else if (val <= 0xFFFF) {
+    out.put(major | 25);
+    bytes = 2;
+  } else if (val <= 0xFFFFFFFF) {
+    out.put(major | 26);
+    bytes = 4;
+  } else {
+    out.put(major | 27);
+    bytes = 8;
+  }
+  for (int i = bytes - 1; i >= 0; --i) {
+    out.put((uint8_t)(val >> (8 * i)));
+  }
+}
+
+void CborInt(Output& out, int64_t val) {
+  if (val >= 0) {
+    CborHead(out, kCborUnsigned, val);
+  } else {
+    CborHead(out, kCborNegative, (uint64_t)(-1 - val));
+  }
+}
+
+void CborSimple(Output& out, uint8_t val) { out.put((kCborSimple << 5) | val); }
+
+void JsonInt(Output& out, int64_t val) {
+  char buf[20];
+  int len = 0;
+  uint64_t abs = (val < 0) ? (uint64_t)(-(val + 1)) + 1 : (uint64_t)val;
+  do {
+    buf[len++] = '0' + (abs % 10);
+    abs /= 10;
+  } while (abs > 0);
+  if (val < 0) out.put('-');
+  while (len > 0) out.put(buf[--len]);
+}
+
+// Writes the temperature in °C, exactly (e.g. 21.5625), without using
+// floating point.
+void JsonRawTemperature(Output& out, int16_t raw) {
+  int32_t val = raw;
+  if (val < 0) {
+    out.put('-');
+    val = -val;
+  }
+  JsonInt(out, val >> 4);
+  int32_t frac = (val & 15) * 625;
+  if (frac == 0) return;
+  out.put('.');
+  char digits[4];
+  for (int i = 3; i >= 0; --i) {
+    digits[i] = '0' + frac % 10;
+    frac /= 10;
+  }
+  int len = 4;
+  while (digits[len - 1] == '0') --len;
+  out.put(digits, len);
+}
+
+void JsonRomCode(Output& out, RomCode rom_code) {
+  char buf[16];
+  rom_code.toCharArray(buf);
+  out.put('"');
+  out.put(buf, 16);
+  out.put('"');
+}
+
+// Calls `changed` for each entry in `current` that is new or different from
+// `previous` (or for every entry, if not `delta`), and `removed` for each
+// entry in `previous` that is not in `current`. Both must be sorted by rom
+// code.
+template <typename Entry, typename ChangedFn, typename RemovedFn>
+void Diff(const std::vector<Entry>& previous, const std::vector<Entry>& current,
+          bool delta, ChangedFn changed, RemovedFn removed) {
+  size_t p = 0;
+  for (const Entry& e : current) {
+    while (delta && p < previous.size() && previous[p].rom_code < e.rom_code) {
+      removed(previous[p++]);
+    }
+    if (delta && p < previous.size() && previous[p].rom_code == e.rom_code) {
+      const Entry& prev = previous[p++];
+      if (prev.raw_temperature == e.raw_temperature &&
+          prev.role_id == e.role_id) {
+        continue;
+      }
+    }
+    changed(e);
+  }
+  while (delta && p < previous.size()) {
+    removed(previous[p++]);
+  }
+}
+
+}  // namespace
+
+TelemetrySerializer::TelemetrySerializer(const Thermometers& thermometers,
+                                         const ThermometerRoles* roles)
+    : thermometers_(thermometers), roles_(roles) {}
+
+void TelemetrySerializer::capture() {
+  current_.clear();
+  // Thermometers are kept sorted by rom code.
+  for (const Thermometer& t : thermometers_) {
+    Entry e;
+    e.rom_code = t.rom_code();
+    e.raw_temperature = t.raw_temperature();
+    e.role_id =
+        (roles_ == nullptr) ? -1 : roles_->roleIdByRomCode(t.rom_code());
+    e.reading_time = t.reading_time();
+    current_.push_back(e);
+  }
+}
+
+size_t TelemetrySerializer::write(uint8_t* buf, size_t capacity, Format format,
+                                  bool delta) {
+  capture();
+  delta = delta && !previous_.empty();
+  Uptime now = Uptime::Now();
+  Output out(buf, capacity);
+  auto age_ms = [&](const Entry& e) -> int64_t {
+    if (e.reading_time == Uptime::Start()) return -1;
+    return (now - e.reading_time).inMillis();
+  };
+  if (format == FORMAT_BINARY) {
+    int changed_count = 0;
+    int removed_count = 0;
+    Diff(
+        previous_, current_, delta, [&](const Entry&) { ++changed_count; },
+        [&](const Entry&) { ++removed_count; });
+    CborHead(out, kCborArray, 5);
+    CborInt(out, kVersion);
+    CborSimple(out, delta ? kCborTrue : kCborFalse);
+    CborInt(out, now.inMillis());
+    CborHead(out, kCborArray, changed_count);
+    Diff(
+        previous_, current_, delta,
+        [&](const Entry& e) {
+          CborHead(out, kCborArray, 4);
+          CborHead(out, kCborUnsigned, e.rom_code.raw());
+          if (e.raw_temperature == kUnknownRawTemperature) {
+            CborSimple(out, kCborNull);
+          } else {
+            CborInt(out, e.raw_temperature);
+          }
+          int64_t age = age_ms(e);
+          if (age < 0) {
+            CborSimple(out, kCborNull);
+          } else {
+            CborInt(out, age);
+          }
+          CborInt(out, e.role_id);
+        },
+        [](const Entry&) {});
+    CborHead(out, kCborArray, removed_count);
+    Diff(
+        previous_, current_, delta, [](const Entry&) {},
+        [&](const Entry& e) {
+          CborHead(out, kCborUnsigned, e.rom_code.raw());
+        });
+  } else {
+    out.put("{\"v\":");
+    JsonInt(out, kVersion);
+    out.put(delta ? ",\"delta\":true,\"t\":" : ",\"delta\":false,\"t\":");
+    JsonInt(out, now.inMillis());
+    out.put(",\"sensors\":[");
+    bool first = true;
+    Diff(
+        previous_, current_, delta,
+        [&](const Entry& e) {
+          if (!first) out.put(',');
+          first = false;
+          out.put("{\"rom\":");
+          JsonRomCode(out, e.rom_code);
+          out.put(",\"temp\":");
+          if (e.raw_temperature == kUnknownRawTemperature) {
+            out.put("null");
+          } else {
+            JsonRawTemperature(out, e.raw_temperature);
+          }
+          out.put(",\"age\":");
+          int64_t age = age_ms(e);
+          if (age < 0) {
+            out.put("null");
+          } else {
+            JsonInt(out, age);
+          }
+          out.put(",\"role\":");
+          JsonInt(out, e.role_id);
+          out.put('}');
+        },
+        [](const Entry&) {});
+    out.put("],\"removed\":[");
+    first = true;
+    Diff(
+        previous_, current_, delta, [](const Entry&) {},
+        [&](const Entry& e) {
+          if (!first) out.put(',');
+          first = false;
+          JsonRomCode(out, e.rom_code);
+        });
+    out.put("]}");
+  }
+  if (!out.ok()) return 0;
+  previous_.swap(current_);
+  return out.size();
+}
+
+namespace {
+
+// Reads CBOR items from a buffer. Supports the subset used by
+// TelemetrySerializer.
+class Input {
+ public:
+  Input(const uint8_t* data, size_t size) : data_(data), size_(size), pos_(0) {}
+
+  // Reads the head of the next item. For simple values, `val` receives the
+  // simple value.
+  bool head(uint8_t& major, uint64_t& val) {
+    if (pos_ >= size_) return false;
+    uint8_t initial = data_[pos_++];
+    major = initial >> 5;
+    uint8_t info = initial & 0x1F;
+    if (info < 24) {
+      val = info;
+      return true;
+    }
+    if (info > 27) return false;
+    int bytes = 1 << (info - 24);
+    if (pos_ + bytes > size_) return false;
+    val = 0;
+    for (int i = 0; i < bytes; ++i) {
+      val = (val << 8) | data_[pos_++];
+    }
+    return true;
+  }
+
+  bool array(uint64_t& len) {
+    uint8_t major;
+    return head(major, len) && major == kCborArray;
+  }
+
+  // Reads an integer, or null (setting `is_null`).
+  bool integer(int64_t& val, bool& is_null) {
+    uint8_t major;
+    uint64_t raw;
+    if (!head(major, raw)) return false;
+    is_null = false;
+    switch (major) {
+      case kCborUnsigned: {
+        val = (int64_t)raw;
+        return true;
+      }
+      case kCborNegative: {
+        val = -1 - (int64_t)raw;
+        return true;
+      }
+      case kCborSimple: {
+        is_null = true;
+        return raw == kCborNull;
+      }
+      default: {
+        return false;
+      }
+    }
+  }
+
+  bool integer(int64_t& val) {
+    bool is_null;
+    return integer(val, is_null) && !is_null;
+  }
+
+  bool boolean(bool& val) {
+    uint8_t major;
+    uint64_t raw;
+    if (!head(major, raw) || major != kCborSimple) return false;
+    if (raw != kCborFalse && raw != kCborTrue) return false;
+    val = (raw == kCborTrue);
+    return true;
+  }
+
+  bool romCode(RomCode& rom_code) {
+    uint8_t major;
+    uint64_t raw;
+    if (!head(major, raw) || major != kCborUnsigned) return false;
+    rom_code = RomCode(raw);
+    return true;
+  }
+
+  bool done() const { return pos_ == size_; }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t pos_;
+};
+
+}  // namespace
+
+bool TelemetryDecoder::decode(const uint8_t* data, size_t size) {
+  Input in(data, size);
+  uint64_t len;
+  int64_t version;
+  if (!in.array(len) || len != 5) return false;
+  if (!in.integer(version) || version != TelemetrySerializer::kVersion) {
+    return false;
+  }
+  if (!in.boolean(delta_) || !in.integer(time_ms_)) return false;
+  if (!delta_) records_.clear();
+  auto find = [this](RomCode rom_code) {
+    return std::lower_bound(records_.begin(), records_.end(), rom_code,
+                            [](const Record& r, RomCode rom_code) {
+                              return r.rom_code < rom_code;
+                            });
+  };
+  uint64_t count;
+  if (!in.array(count)) return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    uint64_t fields;
+    Record r;
+    int64_t val;
+    bool is_null;
+    if (!in.array(fields) || fields != 4) return false;
+    if (!in.romCode(r.rom_code)) return false;
+    if (!in.integer(val, is_null)) return false;
+    r.raw_temperature = is_null ? kUnknownRawTemperature : (int16_t)val;
+    if (!in.integer(val, is_null)) return false;
+    r.age_ms = is_null ? -1 : (int32_t)val;
+    if (!in.integer(val)) return false;
+    r.role_id = (int16_t)val;
+    auto itr = find(r.rom_code);
+    if (itr != records_.end() && itr->rom_code == r.rom_code) {
+      *itr = r;
+    } else {
+      records_.insert(itr, r);
+    }
+  }
+  if (!in.array(count)) return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    RomCode rom_code;
+    if (!in.romCode(rom_code)) return false;
+    auto itr = find(rom_code);
+    if (itr != records_.end() && itr->rom_code == rom_code) {
+      records_.erase(itr);
+    }
+  }
+  return in.done();
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "roo_onewire/rom_code.h"
+#include "roo_onewire/thermometer_roles.h"
+#include "roo_onewire/thermometers.h"
+
+namespace roo_onewire {
+
+// Writes snapshots of all thermometer readings (and, optionally, role
+// bindings) directly into a caller-supplied buffer, without allocating.
+//
+// Two formats are supported:
+//
+// * FORMAT_BINARY: a CBOR subset, decodable by any CBOR parser (and by
+//   TelemetryDecoder, below). The snapshot is an array:
+//     [version, delta, time_ms, [entry...], [removed_rom_code...]]
+//   where each entry is an array:
+//     [rom_code, raw_temperature, age_ms, role_id]
+//   rom_code is a 64-bit unsigned integer (the same value as
+//   RomCode::raw()); raw_temperature is in 1/16 °C; age_ms is the time since
+//   the reading was taken; role_id is -1 if no role is bound. Unknown
+//   temperatures and ages are encoded as null.
+//
+// * FORMAT_JSON:
+//     {"v":1,"delta":false,"t":123456,"sensors":[{"rom":"28FF...","temp":
+//     21.5625,"age":120,"role":3},...],"removed":["28FF..."]}
+//
+// In the delta mode, the snapshot contains only the thermometers whose
+// temperature or role binding changed since the previous snapshot, and the
+// rom codes of the ones that disappeared. (Unchanged temperatures are not
+// re-sent, even if they have been re-read.) The first snapshot, and the one
+// after reset(), is always complete.
+class TelemetrySerializer {
+ public:
+  enum Format { FORMAT_BINARY, FORMAT_JSON };
+
+  static const int kVersion = 1;
+
+  TelemetrySerializer(const Thermometers& thermometers,
+                      const ThermometerRoles* roles = nullptr);
+
+  // Writes the snapshot into `buf`, and returns the number of bytes written,
+  // or zero if the snapshot does not fit in `capacity` (in which case, the
+  // delta baseline remains unchanged). JSON output is not null-terminated.
+  size_t write(uint8_t* buf, size_t capacity, Format format, bool delta);
+
+  // Forgets the previous snapshot, so that the next one is complete.
+  void reset() { previous_.clear(); }
+
+ private:
+  struct Entry {
+    RomCode rom_code;
+    int16_t raw_temperature;
+    int16_t role_id;
+    roo_time::Uptime reading_time;
+  };
+
+  // Fills current_ with the state of the thermometers, sorted by rom code.
+  void capture();
+
+  const Thermometers& thermometers_;
+  const ThermometerRoles* roles_;
+
+  // State as of the last successfully written snapshot, sorted by rom code.
+  std::vector<Entry> previous_;
+
+  // Scratch space for the current state; kept to reuse the capacity.
+  std::vector<Entry> current_;
+};
+
+// Decodes snapshots written by TelemetrySerializer in FORMAT_BINARY,
+// maintaining the cumulative state across delta snapshots.
+class TelemetryDecoder {
+ public:
+  struct Record {
+    RomCode rom_code;
+    int16_t raw_temperature;  // kUnknownRawTemperature if unknown.
+    int32_t age_ms;           // -1 if unknown.
+    int16_t role_id;          // -1 if no role is bound.
+  };
+
+  // Applies the snapshot to the state. Returns false if the data is
+  // malformed, in which case the state is unspecified.
+  bool decode(const uint8_t* data, size_t size);
+
+  // Returns the state, sorted by rom code.
+  const std::vector<Record>& records() const { return records_; }
+
+  // Returns the time (in ms since boot) of the last decoded snapshot.
+  int64_t time_ms() const { return time_ms_; }
+
+  // Returns whether the last decoded snapshot was a delta.
+  bool delta() const { return delta_; }
+
+  void clear() { records_.clear(); }
+
+ private:
+  std::vector<Record> records_;
+  int64_t time_ms_ = 0;
+  bool delta_ = false;
+};
+
+}  // namespace roo_onewire
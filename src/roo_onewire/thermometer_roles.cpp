@@ -30,17 +30,60 @@ ThermometerRoles::~ThermometerRoles() {
 
 void ThermometerRoles::setStore(ThermometerRoleStore* store) {
   store_ = store;
-  for (auto& t : thermometer_roles_) {
-    RomCode rom_code = store_->getRomCode(t.id());
+  loadFromStore();
+  bindDevices();
+}
+
+void ThermometerRoles::loadFromStore() {
+  for (const auto& role : thermometer_roles_) {
+    applyPriority(role, 0);
+  }
+  id_by_rom_code_.clear();
+  if (thermometer_roles_.empty()) return;
+  std::vector<int> ids;
+  ids.reserve(thermometer_roles_.size());
+  for (const auto& t : thermometer_roles_) {
+    ids.push_back(t.id());
+  }
+  std::vector<RomCode> rom_codes(ids.size());
+  store_->getRomCodes(&ids[0], &rom_codes[0], ids.size());
+  for (size_t i = 0; i < thermometer_roles_.size(); ++i) {
+    ThermometerRole& t = thermometer_roles_[i];
+    RomCode rom_code = rom_codes[i];
     if (rom_code.isUnknown()) {
-      id_by_rom_code_.erase(rom_code);
+      t.unassign();
     } else {
       t.assign(rom_code);
       id_by_rom_code_[rom_code] = t.id();
+      applyPriority(t, t.priority());
     }
   }
 }
 
+void ThermometerRoles::bindDevices() {
+  for (auto& role : thermometer_roles_) {
+    bindDevice(role);
+  }
+}
+
+void ThermometerRoles::bindDevice(ThermometerRole& role) {
+  role.device_idx_ =
+      role.isAssigned() ? onewire_.thermometers().indexOf(role.rom_code()) : -1;
+}
+
+const Thermometer* ThermometerRoles::boundThermometer(
+    const ThermometerRole& role) const {
+  const Thermometers& thermometers = onewire_.thermometers();
+  int idx = role.device_idx_;
+  // The binding may be momentarily stale, while discovery listeners are being
+  // notified; in this case, we report the thermometer as missing.
+  if (idx < 0 || idx >= thermometers.count() ||
+      thermometers.rom_code(idx) != role.rom_code()) {
+    return nullptr;
+  }
+  return &thermometers.thermometer(idx);
+}
+
 const ThermometerRole& ThermometerRoles::thermometerRoleById(int id) const {
   auto itr = idx_by_id_.find(id);
   CHECK(itr != idx_by_id_.end()) << id;
@@ -48,9 +91,23 @@ const ThermometerRole& ThermometerRoles::thermometerRoleById(int id) const {
 }
 
 roo_temperature::Temperature ThermometerRoles::temperatureById(int id) const {
-  const ThermometerRole& t = thermometerRoleById(id);
-  return t.isAssigned() ? temperatureByRomCode(t.rom_code())
-                        : roo_temperature::Temperature();
+  const Thermometer* t = boundThermometer(thermometerRoleById(id));
+  return t == nullptr ? roo_temperature::Temperature() : t->temperature();
+}
+
+int16_t ThermometerRoles::rawTemperatureById(int id) const {
+  const Thermometer* t = boundThermometer(thermometerRoleById(id));
+  return t == nullptr ? kUnknownRawTemperature : t->raw_temperature();
+}
+
+void ThermometerRoles::temperaturesByIndexes(
+    const int* role_indexes, roo_temperature::Temperature* out,
+    int count) const {
+  for (int i = 0; i < count; ++i) {
+    const ThermometerRole& role = thermometer_roles_[role_indexes[i]];
+    const Thermometer* t = boundThermometer(role);
+    out[i] = (t == nullptr) ? roo_temperature::Temperature() : t->temperature();
+  }
 }
 
 roo_temperature::Temperature ThermometerRoles::temperatureByRomCode(
@@ -62,6 +119,15 @@ roo_temperature::Temperature ThermometerRoles::temperatureByRomCode(
 
 void ThermometerRoles::update() { onewire_.update(); }
 
+void ThermometerRoles::requestReading(roo_time::Interval max_age,
+                                      std::function<void(bool)> callback) {
+  // Thermometers notifies the waiters after all listeners, so the roles are
+  // up to date by the time the callback is called.
+  onewire_.thermometers().requestReading(max_age, std::move(callback));
+}
+
+Wakeup ThermometerRoles::nextWakeup() const { return onewire_.nextWakeup(); }
+
 void ThermometerRoles::refreshUnassignedThermometers() {
   unassigned_thermometers_.clear();
   for (int i = 0; i < onewire_.thermometers().count(); ++i) {
@@ -74,15 +140,34 @@ void ThermometerRoles::refreshUnassignedThermometers() {
 
 void ThermometerRoles::assign(int id, RomCode rom_code) {
   DCHECK(!id_by_rom_code_.contains(rom_code));
-  thermometer_roles_[idx_by_id_[id]].assign(rom_code);
+  ThermometerRole& role = thermometer_roles_[idx_by_id_[id]];
+  role.assign(rom_code);
+  bindDevice(role);
+  applyPriority(role, role.priority());
   id_by_rom_code_[rom_code] = id;
   CHECK_NOTNULL(store_)->setRomCode(id, rom_code);
   refreshUnassignedThermometers();
 }
 
+bool ThermometerRoles::assignByPhysicalPosition(int id, int position) {
+  const Thermometers& thermometers = onewire_.thermometers();
+  int idx = thermometers.indexAtPhysicalPosition(position);
+  if (idx < 0) return false;
+  RomCode rom_code = thermometers.rom_codes()[idx];
+  auto itr = id_by_rom_code_.find(rom_code);
+  if (itr != id_by_rom_code_.end()) {
+    if (itr->second == id) return true;
+    unassign(itr->second);
+  }
+  unassign(id);
+  assign(id, rom_code);
+  return true;
+}
+
 void ThermometerRoles::unassign(int id) {
   ThermometerRole& t = thermometer_roles_[idx_by_id_[id]];
   if (t.isAssigned()) {
+    applyPriority(t, 0);
     id_by_rom_code_.erase(t.rom_code());
     t.unassign();
     CHECK_NOTNULL(store_)->clearRomCode(id);
@@ -90,19 +175,32 @@ void ThermometerRoles::unassign(int id) {
   }
 }
 
+void ThermometerRoles::setPriority(int id, int priority) {
+  ThermometerRole& role = thermometer_roles_[idx_by_id_[id]];
+  role.priority_ = priority;
+  applyPriority(role, priority);
+}
+
+void ThermometerRoles::applyPriority(const ThermometerRole& role,
+                                     int priority) {
+  if (!role.isAssigned()) return;
+  onewire_.thermometers().setReadPriority(role.rom_code(), priority);
+}
+
 void ThermometerRoles::updateTemperatures() {
   for (int i = 0; i < thermometer_roles_count(); ++i) {
     ThermometerRole& role = thermometer_role(i);
-    if (!role.isAssigned()) continue;
-    const Thermometer* t =
-        onewire_.thermometers().thermometerByRomCode(role.rom_code());
-    if (t == nullptr || t->temperature().isUnknown()) continue;
-    role.setLastReading(t->temperature(),
-                        onewire_.thermometers().lastReadingTime());
+    const Thermometer* t = boundThermometer(role);
+    if (t == nullptr || t->raw_temperature() == kUnknownRawTemperature) {
+      continue;
+    }
+    role.setLastReading(t->raw_temperature(), t->reading_time());
   }
 }
 
 void ThermometerRoles::discoveryCompleted() {
+  if (store_->isStoredOnDevices()) loadFromStore();
+  bindDevices();
   refreshUnassignedThermometers();
   for (EventListener* listener : event_listeners_) {
     listener->discoveryCompleted();
@@ -116,6 +214,23 @@ void ThermometerRoles::conversionCompleted() {
   }
 }
 
+void ThermometerRoles::busStateChanged(Thermometers::BusState state) {
+  for (EventListener* listener : event_listeners_) {
+    listener->busStateChanged(state);
+  }
+}
+
+void ThermometerRoles::readingAvailable(const Thermometer& thermometer) {
+  auto itr = id_by_rom_code_.find(thermometer.rom_code());
+  if (itr == id_by_rom_code_.end()) return;
+  ThermometerRole& role = thermometer_roles_[idx_by_id_[itr->second]];
+  role.setLastReading(thermometer.raw_temperature(),
+                      thermometer.reading_time());
+  for (EventListener* listener : event_listeners_) {
+    listener->readingAvailable(role);
+  }
+}
+
 void ThermometerRoles::addEventListener(EventListener* listener) {
   auto result = event_listeners_.insert(listener);
   CHECK(result.second) << "Event listener " << listener
@@ -16,6 +16,12 @@ class ThermometerRoles {
     virtual ~EventListener() = default;
     virtual void discoveryCompleted() {}
     virtual void conversionCompleted() {}
+    virtual void busStateChanged(Thermometers::BusState /*state*/) {}
+
+    // Called as soon as the reading of the role with a positive priority is
+    // available (see ThermometerRoles::setPriority()), before the other
+    // thermometers are read. Should return quickly.
+    virtual void readingAvailable(const ThermometerRole& /*role*/) {}
   };
 
   class ConversionListener : public EventListener {
@@ -49,25 +55,75 @@ class ThermometerRoles {
 
   const ThermometerRole& thermometerRoleById(int id) const;
 
+  // Returns the index (see thermometer_role()) of the role with the given
+  // `id`, or -1 if there is no such role. The index does not change, so it
+  // can be resolved once, and used with temperaturesByIndexes().
+  int roleIndexById(int id) const {
+    auto itr = idx_by_id_.find(id);
+    return (itr == idx_by_id_.end()) ? -1 : itr->second;
+  }
+
   roo_temperature::Temperature temperatureById(int id) const;
 
+  // Like temperatureById(), but returns the raw reading, in 1/16 °C, or
+  // kUnknownRawTemperature. Does not use floating point.
+  int16_t rawTemperatureById(int id) const;
+
   roo_temperature::Temperature temperatureByRomCode(RomCode rom_code) const;
 
+  // Returns the ID of the role assigned to the thermometer with the specified
+  // rom code, or -1 if none.
+  int roleIdByRomCode(RomCode rom_code) const {
+    auto itr = id_by_rom_code_.find(rom_code);
+    return (itr == id_by_rom_code_.end()) ? -1 : itr->second;
+  }
+
+  // Retrieves the most recent temperatures of the `count` roles with the
+  // specified indexes (see roleIndexById()), storing them in the
+  // corresponding entries of `out`. Goes straight to the bound thermometers,
+  // without any lookups by ID or by rom code. Roles that are not assigned, or
+  // whose thermometers are missing, get the unknown temperature.
+  void temperaturesByIndexes(const int* role_indexes,
+                             roo_temperature::Temperature* out,
+                             int count) const;
+
   // Schedules a conversion (if not already scheduled) to read temperatures of
   // assigned roles.
   void update();
 
+  // Requests readings that are at most `max_age` old, and calls `callback`
+  // when they are available, after the roles have been updated. See
+  // Thermometers::requestReading().
+  void requestReading(roo_time::Interval max_age,
+                      std::function<void(bool)> callback);
+
   // Assigns the role with the given `id` to the thermometer with the specified
   // rom code.
   void assign(int id, RomCode rom_code);
 
+  // Assigns the role with the given `id` to the thermometer at the specified
+  // physical position along the cable (see
+  // Thermometers::physicalPosition()). Returns false if the position is not
+  // known.
+  bool assignByPhysicalPosition(int id, int position);
+
   // Unassigns the thermometer from the role with the given `id`.
   void unassign(int id);
 
+  // Sets the read priority of the role with the given `id`, which applies to
+  // whichever thermometer is assigned to the role (see
+  // Thermometers::setReadPriority()). Roles with a positive priority are read
+  // first after each conversion, and their readings are delivered early, via
+  // EventListener::readingAvailable().
+  void setPriority(int id, int priority);
+
   const std::vector<RomCode> unassigned() const {
     return unassigned_thermometers_;
   }
 
+  // Returns when the library next needs to run. See OneWire::nextWakeup().
+  Wakeup nextWakeup() const;
+
   void addEventListener(EventListener* listener);
   void removeEventListener(EventListener* listener);
 
@@ -84,16 +140,40 @@ class ThermometerRoles {
 
     void discoveryCompleted() const override { roles_.discoveryCompleted(); }
     void conversionCompleted() const override { roles_.conversionCompleted(); }
+    void busStateChanged(Thermometers::BusState state) const override {
+      roles_.busStateChanged(state);
+    }
+    void readingAvailable(const Thermometer& thermometer) const override {
+      roles_.readingAvailable(thermometer);
+    }
 
    private:
     ThermometerRoles& roles_;
   };
 
+  // Reloads all assignments from the store.
+  void loadFromStore();
+
+  // Resolves the thermometer indexes of all assigned roles.
+  void bindDevices();
+
+  // Resolves the thermometer index of the specified role.
+  void bindDevice(ThermometerRole& role);
+
+  // Returns the thermometer assigned to the specified role, or nullptr if the
+  // role is not assigned or the thermometer is missing.
+  const Thermometer* boundThermometer(const ThermometerRole& role) const;
+
   void refreshUnassignedThermometers();
   void updateTemperatures();
 
   void discoveryCompleted();
   void conversionCompleted();
+  void busStateChanged(Thermometers::BusState state);
+  void readingAvailable(const Thermometer& thermometer);
+
+  // Sets the read priority of the thermometer assigned to the role, if any.
+  void applyPriority(const ThermometerRole& role, int priority);
 
   OneWire& onewire_;
   ThermometerRoleStore* store_;
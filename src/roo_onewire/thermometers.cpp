@@ -1,11 +1,15 @@
 #include "roo_onewire/thermometers.h"
 
+#include <limits.h>
+
 #include "roo_logging.h"
 #include "roo_onewire.h"
-
-using roo_temperature::Temperature;
+#include "roo_onewire/commands.h"
+#include "roo_onewire/crc8.h"
+#include "roo_onewire/thermometers/conversion_time.h"
 
 using roo_time::Interval;
+using roo_time::Micros;
 using roo_time::Millis;
 using roo_time::Uptime;
 
@@ -13,35 +17,25 @@ namespace roo_onewire {
 
 namespace {
 
-static const uint8_t kReadRom = 0x33;
-static const uint8_t kMatchRom = 0x55;
-static const uint8_t kSkipRom = 0xCC;
-static const uint8_t kAlarmSearch = 0xEC;
-static const uint8_t kConvert = 0x44;
-static const uint8_t kWriteScratchpad = 0x4E;
-static const uint8_t kReadScratchpad = 0xBE;
-static const uint8_t kCopyScratchpad = 0x48;
-static const uint8_t kRecallEEPROM = 0xB8;
-static const uint8_t kReadPowerSupply = 0xB4;
-
 Resolution Read2BitResolution(const Scratchpad& scratchpad) {
   return (Resolution)(((scratchpad[4] >> 5) & 3) + 9);
 }
 
 struct TemperatureData {
   Resolution resolution;
-  Temperature temperature;
+
+  // In 1/16 °C.
+  int16_t raw_temperature;
 };
 
 TemperatureData ReadTemperatureData(DeviceFamily family,
                                     const Scratchpad& scratchpad) {
   switch (family) {
     case DEVICE_FAMILY_DS18S20: {
-      // 9-bit resolution.
+      // 9-bit resolution, in 1/2 °C.
       int16_t fixed_point = (scratchpad[1] << 8) + scratchpad[0];
       return TemperatureData{.resolution = RESOLUTION_9_BITS,
-                             .temperature = roo_temperature::DegCelcius(
-                                 (float)fixed_point / 2.0f)};
+                             .raw_temperature = (int16_t)(fixed_point * 8)};
     }
     case DEVICE_FAMILY_DS18B20:
     case DEVICE_FAMILY_DS1822:
@@ -52,17 +46,81 @@ TemperatureData ReadTemperatureData(DeviceFamily family,
       uint16_t mask = ~((1 << (12 - resolution)) - 1);
       int16_t fixed_point = ((scratchpad[1] << 8) + scratchpad[0]) & mask;
       return TemperatureData{.resolution = resolution,
-                             .temperature = roo_temperature::DegCelcius(
-                                 (float)fixed_point / 16.0f)};
+                             .raw_temperature = fixed_point};
     }
     case DEVICE_FAMILY_MAX31850: {
       // 14-bit resolution.
       return TemperatureData{.resolution = RESOLUTION_14_BITS,
-                             .temperature = roo_temperature::Unknown()};
+                             .raw_temperature = kUnknownRawTemperature};
     }
     default: {
       return TemperatureData{.resolution = RESOLUTION_UNDEFINED,
-                             .temperature = roo_temperature::Unknown()};
+                             .raw_temperature = kUnknownRawTemperature};
+    }
+  }
+}
+
+// Learned conversion time (parasite buses): how often to re-measure, in
+// conversion cycles.
+static const int kConversionTimeRecalibrationPeriod = 256;
+
+// Learned conversion time: how often to poll the bus while measuring.
+static const int kConversionPollMillis = 10;
+
+// Conversion time of a broadcast conversion, when not learned.
+static const int32_t kDefaultConversionMicros = 750000;
+
+// Partial reads: every how many conversions each thermometer gets a full,
+// CRC-checked read.
+static const int kFullReadPeriod = 16;
+
+// Partial reads: the largest change between consecutive readings, in 1/16 °C,
+// considered plausible.
+static const int32_t kMaxPlausibleChange = 10 * 16;
+
+// Estimated bus time of reading a scratchpad at standard speed: reset, Match
+// ROM, Read Scratchpad, 9 bytes, and the reset that terminates the read.
+static const int32_t kScratchpadReadMicros =
+    2 * BusTiming::kResetMicros + (8 + 64 + 8 + 72) * BusTiming::kSlotMicros;
+
+// Same as above, for a partial read: 2 bytes instead of 9.
+static const int32_t kPartialReadMicros =
+    2 * BusTiming::kResetMicros + (8 + 64 + 8 + 16) * BusTiming::kSlotMicros;
+
+// Bus health: number of clean conversions after which a degraded bus is
+// considered healthy again.
+static const int kBusRecoveryCycles = 3;
+
+// Bus health: bounds of the backoff between probes of a bus that is down.
+static constexpr roo_time::Interval kMinProbeBackoff = roo_time::Seconds(1);
+static constexpr roo_time::Interval kMaxProbeBackoff = roo_time::Seconds(64);
+
+// Overdrive: number of consecutive reads that fail at overdrive speed, but
+// succeed at standard speed, before overdrive gets suspended; and for how
+// long.
+static const int kMaxOverdriveFallbacks = 3;
+static constexpr roo_time::Interval kOverdriveSuspension =
+    roo_time::Seconds(600);
+
+// Returns true if the scratchpad, read after a conversion, still contains the
+// power-on reset value (85 °C, or 0x0550; 0x00AA on DS18S20), meaning that the
+// device has been reset (e.g. by a power dip) and missed the conversion.
+// Genuine 85 °C readings are told apart by the COUNT REMAIN register (byte 6),
+// which is 0x0C only after reset.
+bool IsPowerOnReset(DeviceFamily family, const Scratchpad& scratchpad) {
+  if (scratchpad[6] != 0x0C || scratchpad[7] != 0x10) return false;
+  switch (family) {
+    case DEVICE_FAMILY_DS18S20: {
+      return scratchpad[0] == 0xAA && scratchpad[1] == 0x00;
+    }
+    case DEVICE_FAMILY_DS18B20:
+    case DEVICE_FAMILY_DS1822:
+    case DEVICE_FAMILY_DS1825:
+    case DEVICE_FAMILY_DS28EA00: {
+      return scratchpad[0] == 0x50 && scratchpad[1] == 0x05;
+    }
+    default: {
+      return false;
     }
   }
 }
@@ -75,75 +133,511 @@ Thermometers::Thermometers(OneWire& onewire,
                            roo_scheduler::Scheduler& scheduler)
     : onewire_(onewire),
       last_completed_conversion_(Uptime::Start()),
+      last_full_conversion_(Uptime::Start()),
       pending_conversion_(Uptime::Start()),
+      full_cycle_(false),
+      selective_(false),
+      max_concurrent_conversions_(0),
+      grouped_(false),
+      group_begin_(0),
+      group_end_(0),
+      group_completion_(Uptime::Start()),
+      reconverting_(false),
+      learn_conversion_time_(false),
+      learned_conversion_micros_(0),
+      calibrating_(false),
+      using_learned_conversion_time_(false),
+      cycles_until_calibration_(0),
+      conversion_start_(Uptime::Start()),
+      single_device_(false),
+      bus_state_(BUS_HEALTHY),
+      clean_cycles_(0),
+      probe_backoff_(kMinProbeBackoff),
+      next_probe_(Uptime::Start()),
+      holding_bus_(false),
+      overdrive_enabled_(true),
+      overdrive_fallbacks_(0),
+      overdrive_suspended_until_(Uptime::Start()),
+      all_overdrive_capable_(false),
+      read_integrity_(READ_INTEGRITY_FULL),
+      read_cycle_(0),
+      read_stats_(),
+      overlap_discovery_(false),
       conversion_completion_task_(scheduler,
-                                  [this]() { conversionCompleted(); }) {}
+                                  [this]() { conversionCompleted(); }),
+      next_completion_(Uptime::Max()),
+      idx_by_rom_code_(ROO_ONEWIRE_MAX_DEVICES),
+      read_pos_(0),
+      deferred_dispatch_(false),
+      dispatch_budget_(Millis(5)),
+      pending_head_(0),
+      dispatched_event_(),
+      dispatching_(false),
+      in_dispatch_(false),
+      dispatch_listener_pos_(0),
+      slow_listener_count_(0),
+      dispatch_task_(scheduler, [this]() { dispatchEvents(true); }) {
+  if (ROO_ONEWIRE_MAX_DEVICES > 0) {
+    rom_codes_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    thermometers_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    discovered_thermometers_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    positions_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    selected_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    power_on_resets_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    read_order_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    // As many reading waiters as devices, which is arbitrary, but
+    // proportionate.
+    reading_waiters_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    full_cycle_waiters_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    spare_waiters_.reserve(ROO_ONEWIRE_MAX_DEVICES);
+    // A cycle posts a reading per prioritized thermometer, and at most a
+    // discovery, a conversion, and a bus state change; a late dispatch may
+    // see the latter of two cycles.
+    pending_events_.reserve(ROO_ONEWIRE_MAX_DEVICES + 6);
+  }
+}
+
+BusArbiter& Thermometers::arbiter() { return onewire_.arbiter(); }
+
+void Thermometers::updateConversionHold() {
+  // On parasite-powered buses, the strong pull-up must not be interrupted.
+  // (Once the completion task is due, e.g. between split reads, it is not
+  // needed anymore.)
+  bool hold = parasite_ && next_completion_ != Uptime::Max() &&
+              Uptime::Now() < next_completion_;
+  if (hold == holding_bus_) return;
+  if (hold) {
+    arbiter().holdForConversion();
+  } else {
+    arbiter().endConversionHold();
+  }
+  holding_bus_ = hold;
+}
+
+bool Thermometers::checkBusUp() {
+  if (bus_state_ != BUS_DOWN) return true;
+  Uptime now = Uptime::Now();
+  if (now < next_probe_) return false;
+  if (!bus().reset()) {
+    probe_backoff_ = std::min(probe_backoff_ * 2, kMaxProbeBackoff);
+    next_probe_ = now + probe_backoff_;
+    return false;
+  }
+  // Responds again; considered degraded until proven otherwise.
+  probe_backoff_ = kMinProbeBackoff;
+  clean_cycles_ = 0;
+  setBusState(BUS_DEGRADED);
+  return true;
+}
+
+void Thermometers::updateBusState(bool cycle_completed) {
+  if (bus().hasPresenceFailure()) {
+    clean_cycles_ = 0;
+    // Tell a glitch from a dead bus.
+    if (bus().reset()) {
+      if (bus_state_ == BUS_HEALTHY) setBusState(BUS_DEGRADED);
+    } else {
+      probe_backoff_ = kMinProbeBackoff;
+      next_probe_ = Uptime::Now() + probe_backoff_;
+      setBusState(BUS_DOWN);
+    }
+    bus().clearPresenceFailure();
+    return;
+  }
+  if (cycle_completed && bus_state_ == BUS_DEGRADED &&
+      ++clean_cycles_ >= kBusRecoveryCycles) {
+    setBusState(BUS_HEALTHY);
+  }
+}
+
+void Thermometers::setBusState(BusState state) {
+  if (state == bus_state_) return;
+  bus_state_ = state;
+  switch (state) {
+    case BUS_HEALTHY: {
+      LOG(INFO) << "OneWire bus healthy";
+      break;
+    }
+    case BUS_DEGRADED: {
+      LOG(WARNING) << "OneWire bus degraded";
+      break;
+    }
+    case BUS_DOWN: {
+      LOG(ERROR) << "OneWire bus down";
+      break;
+    }
+  }
+  postEvent(PendingEvent::BUS_STATE_CHANGED, true, state);
+}
 
 bool Thermometers::update() {
+  // Held for our own conversion; waiting for it might never return.
+  if (arbiter().isHeldForConversion()) return true;
+  BusArbiter::Transaction transaction(arbiter());
+  if (isConversionPending()) return true;
+  bus().clearPresenceFailure();
+  if (!checkBusUp()) return false;
+  bool result = updateInTransaction();
+  updateBusState(false);
+  return result;
+}
+
+bool Thermometers::updateSelected(const RomCode* rom_codes, int count) {
+  if (arbiter().isHeldForConversion()) return true;
+  BusArbiter::Transaction transaction(arbiter());
+  if (isConversionPending()) return true;
+  bus().clearPresenceFailure();
+  if (!checkBusUp()) return false;
+  bool result = updateSelectedInTransaction(rom_codes, count);
+  updateBusState(false);
+  return result;
+}
+
+void Thermometers::scheduleCompletion(Uptime when) {
+  next_completion_ = when;
+  conversion_completion_task_.scheduleOn(when);
+  // Right away, so that nobody (including the listeners notified within this
+  // transaction) talks over the strong pull-up.
+  updateConversionHold();
+}
+
+Wakeup Thermometers::nextWakeup() const {
+  Wakeup wakeup;
+  if (hasPendingEvents()) {
+    wakeup = Wakeup(Uptime::Now(), dispatch_budget_);
+  }
+  if (next_completion_ != Uptime::Max()) {
+    // Reading the scratchpads is what takes the time.
+    int reads;
+    if (grouped_) {
+      reads = group_end_ - group_begin_;
+    } else if (selective_) {
+      reads = selected_.size() - read_pos_;
+    } else {
+      reads = count() - read_pos_;
+    }
+    // Full reads of the occasional implausible or due values are not
+    // accounted for.
+    int32_t read_micros = (read_integrity_ == READ_INTEGRITY_PARTIAL)
+                              ? kPartialReadMicros
+                              : kScratchpadReadMicros;
+    wakeup = Wakeup::Earliest(
+        wakeup, Wakeup(next_completion_, Micros(reads * read_micros)));
+  }
+  if (bus_state_ == BUS_DOWN) {
+    // update() stops failing fast.
+    wakeup = Wakeup::Earliest(
+        wakeup, Wakeup(next_probe_, Micros(BusTiming::kResetMicros)));
+  }
+  return wakeup;
+}
+
+void Thermometers::conversionCompleted() {
+  if (holding_bus_) {
+    // Nobody else can have taken the bus meanwhile; end the hold so that we
+    // can.
+    arbiter().endConversionHold();
+    holding_bus_ = false;
+  }
+  BusArbiter::Transaction transaction(arbiter());
+  next_completion_ = Uptime::Max();
+  bus().clearPresenceFailure();
+  conversionCompletedInTransaction();
+  updateBusState(!isConversionPending());
+}
+
+bool Thermometers::updateInTransaction() {
   if (isConversionPending()) {
     return true;
   }
   readPowerSupply();
+  // Fail fast, rather than running discovery on a bus that does not respond.
+  if (bus().hasPresenceFailure()) return false;
+  if (overlap_discovery_ && !parasite_ && max_concurrent_conversions_ == 0) {
+    // Convert T is a broadcast, so it does not need the rom codes. Externally
+    // powered devices keep responding to the search while converting, so we
+    // can enumerate the bus during the conversion wait.
+    if (!startConversion()) return false;
+    updateThermometers();
+    return true;
+  }
   updateThermometers();
-  if (!beginConversion()) return false;
-  Interval delay = Millis(750);
-  conversion_completion_task_.scheduleAfter(delay);
+  return startConversion();
+}
+
+bool Thermometers::updateSelectedInTransaction(const RomCode* rom_codes,
+                                               int count) {
+  if (isConversionPending()) {
+    return true;
+  }
+  full_cycle_ = false;
+  selected_.clear();
+  int32_t delay_micros = 0;
+  for (int i = 0; i < count; ++i) {
+    int idx = indexOf(rom_codes[i]);
+    if (idx < 0) continue;
+    const Thermometer& t = thermometers_[idx];
+    selected_.push_back(idx);
+    delay_micros = std::max(delay_micros,
+                            ConversionTimeMicros(t.family(), t.resolution()));
+  }
+  if (selected_.empty()) return false;
+  sortByReadPriority(selected_);
+  if (max_concurrent_conversions_ > 0 &&
+      (int)selected_.size() > maxGroupSize()) {
+    return startGroupedConversion();
+  }
+  if (!beginSelectedConversion()) return false;
+  selective_ = true;
+  Interval delay = Micros(delay_micros);
   pending_conversion_ = Uptime::Now() + delay;
+  scheduleCompletion(pending_conversion_);
   return true;
 }
 
-void Thermometers::updateThermometers() {
-  RomCodeSet discovered = onewire_.discoverAll();
-  // Remove thermometers that disappeared from the bus.
-  for (const auto& i : thermometers_) {
-    if (!discovered.contains(i.rom_code())) {
-      thermometers_.erase(i.rom_code());
+bool Thermometers::startConversion() {
+  full_cycle_ = true;
+  selective_ = false;
+  updateReadOrder();
+  if (max_concurrent_conversions_ > 0 && count() > maxGroupSize()) {
+    selected_.assign(read_order_.begin(), read_order_.end());
+    return startGroupedConversion();
+  }
+  if (!beginConversion()) return false;
+  conversion_start_ = Uptime::Now();
+  calibrating_ = false;
+  using_learned_conversion_time_ = false;
+  Interval delay = Micros(kDefaultConversionMicros);
+  if (learn_conversion_time_ && parasite_) {
+    if (cycles_until_calibration_ <= 0) {
+      // Measure: poll for completion. Each poll releases the strong pull-up
+      // for a single time slot.
+      calibrating_ = true;
+      cycles_until_calibration_ = kConversionTimeRecalibrationPeriod;
+      scheduleCompletion(conversion_start_ + Millis(kConversionPollMillis));
+      pending_conversion_ = conversion_start_ + delay;
+      return true;
     }
+    --cycles_until_calibration_;
+    if (learned_conversion_micros_ > 0) {
+      using_learned_conversion_time_ = true;
+      delay = Micros(learned_conversion_micros_);
+    }
+  }
+  pending_conversion_ = conversion_start_ + delay;
+  scheduleCompletion(pending_conversion_);
+  return true;
+}
+
+bool Thermometers::checkConversionTime() {
+  if (calibrating_) {
+    Uptime now = Uptime::Now();
+    if (bus().read_bit() == 0) {
+      // Still converting; power it again.
+      bus().power();
+      if (now - conversion_start_ < Micros(kDefaultConversionMicros)) {
+        scheduleCompletion(now + Millis(kConversionPollMillis));
+        return false;
+      }
+      LOG(WARNING) << "Conversion did not complete in time";
+      learned_conversion_micros_ = 0;
+    } else {
+      // Add a safety margin of 25%, plus the polling granularity.
+      int64_t measured = (now - conversion_start_).inMicros();
+      learned_conversion_micros_ = std::min<int64_t>(
+          measured + measured / 4 + kConversionPollMillis * 1000,
+          kDefaultConversionMicros);
+    }
+    calibrating_ = false;
+    pending_conversion_ = now;
+    return true;
   }
-  // Add newly discovered thermometers.
+  if (using_learned_conversion_time_) {
+    using_learned_conversion_time_ = false;
+    if (bus().read_bit() == 0) {
+      // Still converting; the readings would be stale.
+      bus().power();
+      LOG(WARNING) << "Learned conversion time of "
+                   << learned_conversion_micros_
+                   << " us is too short; falling back to the default";
+      learned_conversion_micros_ = 0;
+      pending_conversion_ =
+          conversion_start_ + Micros(kDefaultConversionMicros);
+      scheduleCompletion(pending_conversion_);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Thermometers::isUnchanged(const RomCodeSet& discovered) const {
+  if ((int)discovered.size() != count()) return false;
+  for (const auto& i : discovered) {
+    if (indexOf(i) < 0) return false;
+  }
+  return true;
+}
+
+void Thermometers::rebuild(const RomCodeSet& discovered) {
+  std::vector<Thermometer>& thermometers = discovered_thermometers_;
+  thermometers.clear();
   for (const auto& i : discovered) {
-    if (!thermometers_.contains(i)) {
-      Scratchpad scratchpad;
-      if (!readScratchpad(i, scratchpad)) continue;
-      Thermometer t;
-      if (!initThermometer(i, scratchpad, t, /*post_conversion*/ false))
-        continue;
-      thermometers_.insert(t);
+    int idx = indexOf(i);
+    if (idx >= 0) {
+      // Already known.
+      thermometers.push_back(thermometers_[idx]);
+      continue;
     }
+    // Newly discovered.
+    Scratchpad scratchpad;
+    if (!readScratchpad(i, scratchpad)) continue;
+    Thermometer t;
+    if (!initThermometer(i, scratchpad, t, /*post_conversion*/ false)) continue;
+    auto calibration = calibrations_.find(i);
+    if (calibration != calibrations_.end()) {
+      t.setCalibration(calibration->second);
+    }
+    thermometers.push_back(t);
   }
+  std::sort(thermometers.begin(), thermometers.end(),
+            [](const Thermometer& a, const Thermometer& b) {
+              return a.rom_code() < b.rom_code();
+            });
+  thermometers_.swap(thermometers);
   rom_codes_.clear();
-  for (const auto& i : thermometers_) {
-    rom_codes_.push_back(i.rom_code());
+  idx_by_rom_code_.clear();
+  for (size_t i = 0; i < thermometers_.size(); ++i) {
+    rom_codes_.push_back(thermometers_[i].rom_code());
+    idx_by_rom_code_[thermometers_[i].rom_code()] = i;
   }
-  std::sort(rom_codes_.begin(), rom_codes_.end());
-  for (EventListener* listener : event_listeners_) {
-    listener->discoveryCompleted();
+}
+
+void Thermometers::updateThermometers() {
+  const RomCodeSet& discovered = onewire_.discoverAll();
+  if (!isUnchanged(discovered)) {
+    // New devices need to be addressed individually.
+    single_device_ = false;
+    rebuild(discovered);
+    // The broadcast conversion may be in progress already (see
+    // setOverlapDiscoveryWithConversion()).
+    updateReadOrder();
+  }
+  positions_.clear();
+  const std::vector<RomCode>& chain = onewire_.chain();
+  if (!chain.empty()) {
+    positions_.resize(count(), -1);
+    for (size_t i = 0; i < chain.size(); ++i) {
+      int idx = indexOf(chain[i]);
+      if (idx >= 0) positions_[idx] = i;
+    }
+  }
+  // With a single device on the bus, Skip ROM addresses it just as well.
+  single_device_ = (count() == 1 && onewire_.devicesOnBus() == 1);
+  all_overdrive_capable_ = (count() > 0 && onewire_.devicesOnBus() == count());
+  for (const Thermometer& t : thermometers_) {
+    if (t.family() != DEVICE_FAMILY_DS28EA00) all_overdrive_capable_ = false;
+  }
+  postEvent(PendingEvent::DISCOVERY_COMPLETED, true);
+}
+
+Thermometers::Addressing Thermometers::addressing(RomCode rom_code) const {
+  // DS28EA00 is the only supported family capable of overdrive.
+  bool overdrive = useOverdrive() && rom_code.getFamily() == 0x42;
+  if (single_device_) {
+    return overdrive ? ADDRESSING_OVERDRIVE_SKIP : ADDRESSING_SKIP;
+  }
+  return overdrive ? ADDRESSING_OVERDRIVE_MATCH : ADDRESSING_MATCH;
+}
+
+bool Thermometers::useOverdrive() const {
+  return overdrive_enabled_ && !isOverdriveSuspended();
+}
+
+bool Thermometers::isOverdriveSuspended() const {
+  return Uptime::Now() < overdrive_suspended_until_;
+}
+
+void Thermometers::setOverdrive(bool enabled) {
+  overdrive_enabled_ = enabled;
+  overdrive_fallbacks_ = 0;
+  overdrive_suspended_until_ = Uptime::Start();
+}
+
+void Thermometers::address(Bus& bus, RomCode rom_code, Addressing addressing) {
+  OneWireDeviceAddress addr;
+  switch (addressing) {
+    case ADDRESSING_MATCH: {
+      rom_code.toOneWireDeviceAddress(addr);
+      bus.select(addr);
+      break;
+    }
+    case ADDRESSING_SKIP: {
+      bus.skip();
+      break;
+    }
+    case ADDRESSING_OVERDRIVE_MATCH: {
+      rom_code.toOneWireDeviceAddress(addr);
+      bus.overdriveSelect(addr);
+      break;
+    }
+    case ADDRESSING_OVERDRIVE_SKIP: {
+      bus.overdriveSkip();
+      break;
+    }
   }
 }
 
 bool Thermometers::readScratchpad(RomCode rom_code, Scratchpad& scratchpad) {
-  if (!bus().reset()) {
+  Addressing mode = addressing(rom_code);
+  ++read_stats_.full_reads;
+  if (single_device_) ++read_stats_.skip_rom_reads;
+  bool overdrive =
+      (mode == ADDRESSING_OVERDRIVE_MATCH || mode == ADDRESSING_OVERDRIVE_SKIP);
+  if (readScratchpad(bus(), rom_code, scratchpad, mode)) {
+    if (overdrive) overdrive_fallbacks_ = 0;
+    return true;
+  }
+  if (overdrive) {
+    // Retry at standard speed; if that works, overdrive may not be reliable
+    // on this bus. (A single failure may just be noise.)
+    mode = single_device_ ? ADDRESSING_SKIP : ADDRESSING_MATCH;
+    if (readScratchpad(bus(), rom_code, scratchpad, mode)) {
+      if (++overdrive_fallbacks_ >= kMaxOverdriveFallbacks) {
+        LOG(WARNING) << "Overdrive communication unreliable; suspending for "
+                     << kOverdriveSuspension.inMillis() / 1000 << " s";
+        overdrive_fallbacks_ = 0;
+        overdrive_suspended_until_ = Uptime::Now() + kOverdriveSuspension;
+      }
+      return true;
+    }
+  }
+  ++read_stats_.failed_reads;
+  return false;
+}
+
+bool Thermometers::readScratchpad(Bus& bus, RomCode rom_code,
+                                  Scratchpad& scratchpad,
+                                  Addressing addressing) {
+  if (!bus.reset()) {
     LOG(ERROR) << "Reading scratchpad failed for OneWire device " << rom_code
                << " (bus error)";
     return false;
   }
 
-  OneWireDeviceAddress addr;
-  rom_code.toOneWireDeviceAddress(addr);
-  bus().select(addr);
-  bus().write(kReadScratchpad);
+  address(bus, rom_code, addressing);
+  bus.write(kReadScratchpad);
 
   for (uint8_t i = 0; i < 9; i++) {
-    scratchpad[i] = bus().read();
+    scratchpad[i] = bus.read();
   }
-  if (!bus().reset()) {
+  if (!bus.reset()) {
     LOG(ERROR) << "Reading scratchpad failed for OneWire device " << rom_code
                << " (protocol error)";
     return false;
   }
 
   // Verify CRC.
-  if (bus().crc8(&scratchpad[0], 8) != scratchpad[8]) {
+  if (Crc8(&scratchpad[0], 8) != scratchpad[8]) {
     LOG(ERROR) << "Reading scratchpad failed for OneWire device " << rom_code
                << " (CRC error)";
     return false;
@@ -211,30 +705,537 @@ bool Thermometers::initThermometer(RomCode rom_code,
       return false;
     }
   }
-  t.set(rom_code, family, temperature.resolution,
-        post_conversion ? temperature.temperature : roo_temperature::Unknown());
+  uint16_t user_bytes = (family == DEVICE_FAMILY_MAX31850)
+                            ? 0
+                            : ((scratchpad[2] << 8) | scratchpad[3]);
+  t.set(rom_code, family, temperature.resolution, user_bytes,
+        post_conversion ? t.calibration().apply(temperature.raw_temperature)
+                        : kUnknownRawTemperature);
   return true;
 }
 
+bool Thermometers::writeUserBytes(RomCode rom_code, uint16_t user_bytes) {
+  if (arbiter().isHeldForConversion()) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (conversion in progress)";
+    return false;
+  }
+  BusArbiter::Transaction transaction(arbiter());
+  int idx = indexOf(rom_code);
+  if (idx < 0) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (device not found)";
+    return false;
+  }
+  Thermometer& t = thermometers_[idx];
+  if (!t.hasUserBytes()) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (not supported by " << t.family() << ")";
+    return false;
+  }
+  OneWireDeviceAddress addr;
+  rom_code.toOneWireDeviceAddress(addr);
+  if (!bus().reset()) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (bus error)";
+    return false;
+  }
+  bus().select(addr);
+  bus().write(kWriteScratchpad);
+  bus().write(user_bytes >> 8);
+  bus().write(user_bytes & 0xFF);
+  if (t.family() != DEVICE_FAMILY_DS18S20) {
+    // The configuration register must be written as well; preserve the
+    // resolution.
+    bus().write(((t.resolution() - 9) << 5) | 0x1F);
+  }
+  if (!bus().reset()) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (protocol error)";
+    return false;
+  }
+  bus().select(addr);
+  bus().write(kCopyScratchpad, parasite_);
+  // Per datasheets, copying to EEPROM takes up to 10ms. On parasite-powered
+  // buses, the strong pull-up must be held for that long.
+  delay(10);
+  if (parasite_) bus().depower();
+
+  // Verify that the data has made it.
+  Scratchpad scratchpad;
+  if (!readScratchpad(rom_code, scratchpad)) return false;
+  uint16_t written = (scratchpad[2] << 8) | scratchpad[3];
+  if (written != user_bytes) {
+    LOG(ERROR) << "Writing user bytes failed for OneWire device " << rom_code
+               << " (verification error)";
+    return false;
+  }
+  t.set(rom_code, t.family(), t.resolution(), user_bytes,
+        t.raw_temperature());
+  return true;
+}
+
+void Thermometers::setCalibration(RomCode rom_code,
+                                  const Calibration& calibration) {
+  calibrations_[rom_code] = calibration;
+  int idx = indexOf(rom_code);
+  if (idx >= 0) thermometers_[idx].setCalibration(calibration);
+}
+
+void Thermometers::clearCalibration(RomCode rom_code) {
+  calibrations_.erase(rom_code);
+  int idx = indexOf(rom_code);
+  if (idx >= 0) thermometers_[idx].setCalibration(Calibration());
+}
+
+void Thermometers::setReadPriority(RomCode rom_code, int priority) {
+  if (priority == 0) {
+    read_priorities_.erase(rom_code);
+  } else {
+    read_priorities_[rom_code] = priority;
+  }
+}
+
+void Thermometers::sortByReadPriority(std::vector<int>& indexes) const {
+  if (read_priorities_.empty()) return;
+  // Insertion sort: stable, in place, and fast for the short lists at hand.
+  for (size_t i = 1; i < indexes.size(); ++i) {
+    int idx = indexes[i];
+    int priority = readPriorityAt(idx);
+    size_t j = i;
+    while (j > 0 && readPriorityAt(indexes[j - 1]) < priority) {
+      indexes[j] = indexes[j - 1];
+      --j;
+    }
+    indexes[j] = idx;
+  }
+}
+
+void Thermometers::updateReadOrder() {
+  read_order_.clear();
+  for (int i = 0; i < count(); ++i) {
+    read_order_.push_back(i);
+  }
+  sortByReadPriority(read_order_);
+}
+
 bool Thermometers::beginConversion() {
   if (!bus().reset()) return false;
-  bus().skip();
+  if (useOverdrive() && all_overdrive_capable_) {
+    bus().overdriveSkip();
+  } else {
+    bus().skip();
+  }
   bus().write(kConvert, parasite_);
   return true;
 }
 
-void Thermometers::conversionCompleted() {
-  last_completed_conversion_ = pending_conversion_;
+bool Thermometers::beginSelectedConversion() {
+  if (parasite_ && selected_.size() > 1) return beginConversion();
+  for (int idx : selected_) {
+    if (!bus().reset()) return false;
+    RomCode rom_code = thermometers_[idx].rom_code();
+    address(bus(), rom_code, addressing(rom_code));
+    bus().write(kConvert, parasite_);
+  }
+  return true;
+}
+
+bool Thermometers::readTemperatureBytes(const Thermometer& t, int16_t& raw) {
+  ++read_stats_.partial_reads;
+  if (single_device_) ++read_stats_.skip_rom_reads;
+  if (!bus().reset()) {
+    ++read_stats_.failed_reads;
+    return false;
+  }
+  address(bus(), t.rom_code(), addressing(t.rom_code()));
+  bus().write(kReadScratchpad);
+  uint8_t lsb = bus().read();
+  uint8_t msb = bus().read();
+  // Terminates the read.
+  if (!bus().reset()) {
+    ++read_stats_.failed_reads;
+    return false;
+  }
+  int16_t fixed_point = (msb << 8) | lsb;
+  if (t.family() == DEVICE_FAMILY_DS18S20) {
+    // In 1/2 °C.
+    raw = fixed_point * 8;
+  } else {
+    raw = fixed_point & ~((1 << (12 - t.resolution())) - 1);
+  }
+  return true;
+}
+
+bool Thermometers::isPlausible(const Thermometer& t, int16_t raw) const {
+  // Outside of the measurement range.
+  if (raw < -55 * 16 || raw > 125 * 16) return false;
+  // Possibly the power-on reset value; needs the full scratchpad to tell.
+  if (raw == 85 * 16) return false;
+  int16_t previous = t.raw_temperature();
+  if (previous == kUnknownRawTemperature) return false;
+  int32_t change = (int32_t)t.calibration().apply(raw) - previous;
+  return change <= kMaxPlausibleChange && change >= -kMaxPlausibleChange;
+}
+
+void Thermometers::readThermometer(int idx, Uptime reading_time) {
+  // Fail fast after the first presence failure in the transaction.
+  if (bus().hasPresenceFailure()) return;
+  Thermometer& t = thermometers_[idx];
+  if (read_integrity_ == READ_INTEGRITY_PARTIAL && !reconverting_ &&
+      t.family() != DEVICE_FAMILY_MAX31850 &&
+      (read_cycle_ + idx) % kFullReadPeriod != 0) {
+    int16_t raw;
+    if (!readTemperatureBytes(t, raw)) return;
+    if (isPlausible(t, raw)) {
+      t.set(t.rom_code(), t.family(), t.resolution(), t.user_bytes(),
+            t.calibration().apply(raw));
+      t.setReadingTime(reading_time);
+      notifyReadingAvailable(idx);
+      return;
+    }
+    // Verify with a full read.
+    ++read_stats_.implausible_reads;
+  }
+  Scratchpad scratchpad;
+  if (!readScratchpad(t.rom_code(), scratchpad)) return;
+  if (IsPowerOnReset(t.family(), scratchpad)) {
+    if (!reconverting_) {
+      // Keep the previous reading; the device gets converted again before
+      // the cycle completes.
+      power_on_resets_.push_back(idx);
+      return;
+    }
+    // Converted again, and still not a reading (e.g. the device keeps
+    // browning out). Keep the previous reading, as stale.
+    LOG(ERROR) << "Power-on reset value read again from OneWire device "
+               << t.rom_code() << " after re-conversion";
+    ++read_stats_.failed_reads;
+    return;
+  }
+  if (!initThermometer(t.rom_code(), scratchpad, t, /*post_conversion*/ true)) {
+    return;
+  }
+  t.setReadingTime(reading_time);
+  notifyReadingAvailable(idx);
+}
+
+void Thermometers::notifyReadingAvailable(int idx) {
+  if (readPriorityAt(idx) <= 0) return;
+  PendingEvent event;
+  event.type = PendingEvent::READING_AVAILABLE;
+  event.success = true;
+  event.bus_state = bus_state_;
+  event.rom_code = thermometers_[idx].rom_code();
+  postEvent(std::move(event));
+}
+
+bool Thermometers::readInOrder(const std::vector<int>& order,
+                               Uptime reading_time) {
+  while (read_pos_ < (int)order.size()) {
+    int idx = order[read_pos_++];
+    readThermometer(idx, reading_time);
+    if (readPriorityAt(idx) > 0 && read_pos_ < (int)order.size() &&
+        readPriorityAt(order[read_pos_]) <= 0 &&
+        !bus().hasPresenceFailure()) {
+      // Give the critical readings a chance to be acted upon before reading
+      // the rest.
+      scheduleCompletion(Uptime::Now());
+      return false;
+    }
+  }
+  read_pos_ = 0;
+  return true;
+}
+
+int Thermometers::maxGroupSize() const {
+  // With parasite power, the addressed device needs the strong pull-up for
+  // the entire conversion, which blocks the bus; so only one device can be
+  // started individually.
+  if (parasite_) return 1;
+  return max_concurrent_conversions_ > 0 ? max_concurrent_conversions_
+                                         : INT_MAX;
+}
+
+bool Thermometers::startGroupedConversion() {
+  selective_ = true;
+  grouped_ = true;
+  if (!beginGroup(0)) {
+    grouped_ = false;
+    selective_ = false;
+    return false;
+  }
+  return true;
+}
+
+bool Thermometers::beginGroup(int begin) {
+  int end = std::min<int>(begin + maxGroupSize(), selected_.size());
+  int32_t delay_micros = 0;
+  for (int i = begin; i < end; ++i) {
+    const Thermometer& t = thermometers_[selected_[i]];
+    if (!bus().reset()) return false;
+    address(bus(), t.rom_code(), addressing(t.rom_code()));
+    bus().write(kConvert, parasite_);
+    delay_micros = std::max(delay_micros,
+                            ConversionTimeMicros(t.family(), t.resolution()));
+  }
+  group_begin_ = begin;
+  group_end_ = end;
+  Interval delay = Micros(delay_micros);
+  group_completion_ = Uptime::Now() + delay;
+  scheduleCompletion(group_completion_);
+  // Estimate, assuming the remaining groups take as long as this one.
+  int remaining_groups = (selected_.size() - end + maxGroupSize() - 1) /
+                         maxGroupSize();
+  pending_conversion_ =
+      group_completion_ + Micros(delay_micros * remaining_groups);
+  return true;
+}
+
+void Thermometers::groupCompleted() {
+  Uptime reading_time = group_completion_;
+  int begin = group_begin_;
+  int end = group_end_;
+  bool more = (end < (int)selected_.size());
+  if (more && !parasite_) {
+    // Pipeline: get the next group converting, and read this one meanwhile.
+    more = beginGroup(end);
+  }
+  for (int i = begin; i < end; ++i) {
+    readThermometer(selected_[i], reading_time);
+  }
+  if (more && parasite_) {
+    more = beginGroup(end);
+  }
+  if (more) return;
+  grouped_ = false;
+  selective_ = false;
+  if (reconvertPowerOnResets()) return;
+  finishConversion(reading_time);
+}
+
+void Thermometers::conversionCompletedInTransaction() {
+  if (grouped_) {
+    groupCompleted();
+    return;
+  }
+  // When resuming the reads, the conversion has been verified already.
+  if (read_pos_ == 0 && !checkConversionTime()) return;
+  Uptime reading_time = pending_conversion_;
+  if (!readInOrder(selective_ ? selected_ : read_order_, reading_time)) return;
+  selective_ = false;
+  if (reconvertPowerOnResets()) return;
+  finishConversion(reading_time);
+}
+
+bool Thermometers::reconvertPowerOnResets() {
+  if (power_on_resets_.empty()) return false;
+  if (bus().hasPresenceFailure()) {
+    power_on_resets_.clear();
+    return false;
+  }
+  if (learned_conversion_micros_ > 0) {
+    // Possibly browned out while polling, or read before completing.
+    learned_conversion_micros_ = 0;
+  }
+  LOG(WARNING) << "Power-on reset value read from " << power_on_resets_.size()
+               << " thermometer(s); converting them again";
+  selected_.swap(power_on_resets_);
+  power_on_resets_.clear();
+  reconverting_ = true;
+  // Matched individually, so that the re-conversion does not load the bus
+  // with all the devices again.
+  if (startGroupedConversion()) return true;
+  reconverting_ = false;
+  return false;
+}
+
+void Thermometers::finishConversion(Uptime reading_time) {
+  reconverting_ = false;
+  ++read_cycle_;
   pending_conversion_ = Uptime::Start();
-  for (const auto& i : rom_codes_) {
-    Scratchpad scratchpad;
-    if (readScratchpad(i, scratchpad)) {
-      initThermometer(i, scratchpad, *thermometers_.find(i),
-                      /*post_conversion*/ true);
+  if (bus().hasPresenceFailure()) {
+    // Some of the readings are missing; let the waiters know, including
+    // those waiting for a full conversion, which would fail fast anyway.
+    for (auto& waiter : full_cycle_waiters_) {
+      reading_waiters_.push_back(std::move(waiter));
+    }
+    full_cycle_waiters_.clear();
+    postEvent(PendingEvent::CONVERSION_COMPLETED, false);
+    return;
+  }
+  last_completed_conversion_ = reading_time;
+  if (full_cycle_) last_full_conversion_ = reading_time;
+  postEvent(PendingEvent::CONVERSION_COMPLETED, true);
+  startFullCycleForWaiters();
+}
+
+void Thermometers::startFullCycleForWaiters() {
+  if (full_cycle_waiters_.empty()) return;
+  if (isConversionPending()) {
+    // Started by a synchronously called listener. If it is selective, keep
+    // waiting for it to complete.
+    if (!full_cycle_) return;
+  } else if (!updateInTransaction()) {
+    for (auto& waiter : full_cycle_waiters_) {
+      reading_waiters_.push_back(std::move(waiter));
+    }
+    full_cycle_waiters_.clear();
+    postEvent(PendingEvent::CONVERSION_COMPLETED, false);
+    return;
+  }
+  for (auto& waiter : full_cycle_waiters_) {
+    reading_waiters_.push_back(std::move(waiter));
+  }
+  full_cycle_waiters_.clear();
+}
+
+void Thermometers::requestReading(Interval max_age,
+                                  std::function<void(bool)> callback) {
+  if (isConversionPending()) {
+    // Only a full conversion provides fresh readings of all thermometers.
+    if (full_cycle_) {
+      reading_waiters_.push_back(std::move(callback));
+    } else {
+      full_cycle_waiters_.push_back(std::move(callback));
     }
+    return;
   }
-  for (auto& listener : event_listeners_) {
-    listener->conversionCompleted();
+  if (last_full_conversion_ != Uptime::Start() &&
+      Uptime::Now() - last_full_conversion_ <= max_age) {
+    callback(true);
+    return;
+  }
+  if (!update()) {
+    callback(false);
+    return;
+  }
+  reading_waiters_.push_back(std::move(callback));
+}
+
+void Thermometers::postEvent(PendingEvent::Type type, bool success,
+                             BusState bus_state) {
+  PendingEvent event;
+  event.type = type;
+  event.success = success;
+  event.bus_state = bus_state;
+  if (type == PendingEvent::CONVERSION_COMPLETED) {
+    // Callbacks may request further readings, which go to reading_waiters_
+    // anew, backed by the spare capacity.
+    event.waiters.swap(reading_waiters_);
+    reading_waiters_.swap(spare_waiters_);
+  }
+  postEvent(std::move(event));
+}
+
+void Thermometers::postEvent(PendingEvent event) {
+  pending_events_.push_back(std::move(event));
+  if (!deferred_dispatch_) {
+    dispatchEvents(false);
+    return;
+  }
+  if (!dispatch_task_.is_scheduled()) {
+    dispatch_task_.scheduleNow();
+  }
+}
+
+void Thermometers::reclaimWaiters(PendingEvent& event) {
+  event.waiters.clear();
+  if (event.waiters.capacity() > spare_waiters_.capacity()) {
+    spare_waiters_.swap(event.waiters);
+  }
+}
+
+void Thermometers::deliver(const PendingEvent& event,
+                           const EventListener* listener) const {
+  switch (event.type) {
+    case PendingEvent::DISCOVERY_COMPLETED: {
+      listener->discoveryCompleted();
+      break;
+    }
+    case PendingEvent::CONVERSION_COMPLETED: {
+      if (event.success) listener->conversionCompleted();
+      break;
+    }
+    case PendingEvent::BUS_STATE_CHANGED: {
+      listener->busStateChanged(event.bus_state);
+      break;
+    }
+    case PendingEvent::READING_AVAILABLE: {
+      // Skipped if the thermometer has been removed meanwhile.
+      int idx = indexOf(event.rom_code);
+      if (idx >= 0) listener->readingAvailable(thermometers_[idx]);
+      break;
+    }
+  }
+}
+
+void Thermometers::dispatchEvents(bool bounded) {
+  if (in_dispatch_) return;
+  in_dispatch_ = true;
+  Uptime start = Uptime::Now();
+  while (dispatching_ || pending_head_ < pending_events_.size()) {
+    if (!dispatching_) {
+      // Starting a new event; take it, and a snapshot of the listeners.
+      dispatched_event_ = std::move(pending_events_[pending_head_++]);
+      if (pending_head_ == pending_events_.size()) {
+        pending_events_.clear();
+        pending_head_ = 0;
+      }
+      dispatching_ = true;
+      dispatch_listeners_.clear();
+      for (const EventListener* listener : event_listeners_) {
+        dispatch_listeners_.push_back(listener);
+      }
+    }
+    const PendingEvent& event = dispatched_event_;
+    // Listeners first, then the reading waiters.
+    size_t total = dispatch_listeners_.size() + event.waiters.size();
+    while (dispatch_listener_pos_ < total) {
+      if (bounded && Uptime::Now() - start >= dispatch_budget_) {
+        // Out of budget; yield to other tasks (the bus, in particular).
+        dispatch_task_.scheduleNow();
+        in_dispatch_ = false;
+        return;
+      }
+      size_t pos = dispatch_listener_pos_++;
+      Uptime call_start = Uptime::Now();
+      if (pos < dispatch_listeners_.size()) {
+        const EventListener* listener = dispatch_listeners_[pos];
+        if (listener == nullptr) continue;
+        deliver(event, listener);
+        Interval elapsed = Uptime::Now() - call_start;
+        if (elapsed > dispatch_budget_) {
+          ++slow_listener_count_;
+          LOG(WARNING) << "Slow thermometer event listener " << listener
+                       << " took " << elapsed.inMicros() << " us";
+        }
+      } else {
+        event.waiters[pos - dispatch_listeners_.size()](event.success);
+        Interval elapsed = Uptime::Now() - call_start;
+        if (elapsed > dispatch_budget_) {
+          ++slow_listener_count_;
+          LOG(WARNING) << "Slow reading callback took " << elapsed.inMicros()
+                       << " us";
+        }
+      }
+    }
+    dispatching_ = false;
+    dispatch_listener_pos_ = 0;
+    dispatch_listeners_.clear();
+    reclaimWaiters(dispatched_event_);
+  }
+  in_dispatch_ = false;
+}
+
+void Thermometers::setDeferredDispatch(bool enabled, Interval budget) {
+  dispatch_budget_ = budget;
+  if (deferred_dispatch_ == enabled) return;
+  deferred_dispatch_ = enabled;
+  if (!enabled) {
+    // Flush whatever has been queued. If dispatch_task_ is scheduled, it
+    // finds nothing left to do.
+    dispatchEvents(false);
   }
 }
 
@@ -250,10 +1251,15 @@ void Thermometers::addEventListener(EventListener* listener) {
   auto result = event_listeners_.insert(listener);
   CHECK(result.second) << "Event listener " << listener
                        << " was registered already.";
+  // So that taking the snapshot, upon dispatch, does not allocate.
+  dispatch_listeners_.reserve(event_listeners_.size());
 }
 
 void Thermometers::removeEventListener(EventListener* listener) {
   event_listeners_.erase(listener);
+  for (const EventListener*& pending : dispatch_listeners_) {
+    if (pending == listener) pending = nullptr;
+  }
 }
 
 }  // namespace roo_onewire
\ No newline at end of file
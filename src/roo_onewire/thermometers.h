@@ -4,31 +4,74 @@
 
 #include "roo_collections/flat_small_hash_map.h"
 #include "roo_onewire/bus.h"
+#include "roo_onewire/bus_arbiter.h"
 #include "roo_onewire/device_family.h"
 #include "roo_onewire/rom_code.h"
+#include "roo_onewire/thermometers/calibration.h"
 #include "roo_onewire/thermometers/resolution.h"
 #include "roo_onewire/thermometers/thermometer.h"
+#include "roo_onewire/wakeup.h"
 #include "roo_scheduler.h"
 #include "roo_time.h"
 
+// Maximum number of devices per bus. If positive, all the containers are
+// allocated once, upon construction (or, for the listeners, upon
+// registration), and discovery ignores the devices beyond the limit, so that
+// the steady-state operation (update(), conversion, event dispatch, both
+// synchronous and deferred, and requestReading()) does not touch the heap.
+// This assumes that the deferred events are delivered before the next
+// conversion completes, and that requestReading() callbacks capture no more
+// than a pointer or two (so that std::function stores them inline). Zero, the
+// default, means no limit; the containers grow as needed.
+#ifndef ROO_ONEWIRE_MAX_DEVICES
+#define ROO_ONEWIRE_MAX_DEVICES 0
+#endif
+
 namespace roo_onewire {
 
 class OneWire;
 
+template <typename... Devices>
+class StaticOneWire;
+
 using Scratchpad = uint8_t[9];
 
 class Thermometers {
  public:
+  // Health of the bus, as observed by the presence pulses.
+  enum BusState {
+    // The devices respond as expected.
+    BUS_HEALTHY,
+
+    // Some resets have recently gone unanswered, but the bus responds.
+    BUS_DEGRADED,
+
+    // The bus does not respond at all (e.g. shorted or disconnected). Updates
+    // fail immediately, without touching the bus, except for occasional
+    // probes, with exponential backoff.
+    BUS_DOWN,
+  };
+
   class EventListener {
    public:
     virtual ~EventListener() = default;
 
+    // Called when the bus state changes.
+    virtual void busStateChanged(BusState /*state*/) const {}
+
     // Called after the OneWire discovery protocol finishes. The list of
     // thermometers may now be different than before.
     virtual void discoveryCompleted() const {}
 
     // Called when new temperature readings are available on the thermometers.
     virtual void conversionCompleted() const {}
+
+    // Called as soon as the thermometer with a positive read priority (see
+    // setReadPriority()) has been read, before the remaining thermometers.
+    // Delivered like the other events: from the bus task, or, if deferred
+    // dispatch is enabled, from the dispatch task (which runs before the bus
+    // task resumes reading).
+    virtual void readingAvailable(const Thermometer& /*thermometer*/) const {}
   };
 
   class ConversionListener : public EventListener {
@@ -95,23 +138,173 @@ class Thermometers {
   // Returns a thermometer with the specified rom code, or nullptr if such
   // thermometer has not been identified on the bus.
   const Thermometer* thermometerByRomCode(RomCode rom_code) const {
-    const auto itr = thermometers_.find(rom_code);
-    return (itr == thermometers_.end()) ? nullptr : &*itr;
+    int idx = indexOf(rom_code);
+    return (idx < 0) ? nullptr : &thermometers_[idx];
+  }
+
+  // Returns the index of the thermometer with the specified rom code, or -1
+  // if such thermometer has not been identified on the bus. The index remains
+  // valid until the next discovery (see EventListener::discoveryCompleted()).
+  int indexOf(RomCode rom_code) const {
+    const auto itr = idx_by_rom_code_.find(rom_code);
+    return (itr == idx_by_rom_code_.end()) ? -1 : itr->second;
   }
 
   // Returns the ith identified thermometer. The thermometers are
   // ordered by rom code.
-  const Thermometer& thermometer(int idx) const {
-    return *thermometerByRomCode(rom_code(idx));
+  const Thermometer& thermometer(int idx) const { return thermometers_[idx]; }
+
+  // Writes the specified value to the TH (high byte) and TL (low byte)
+  // registers of the specified thermometer, and persists it in the device's
+  // EEPROM. Note that the TH and TL registers double as alarm thresholds, so
+  // using them as general-purpose storage renders alarm search meaningless.
+  // Blocks for about 10ms, while the EEPROM is being written. Returns true on
+  // success; false if the device has not been discovered, does not support
+  // user bytes, or if a communication error occurs.
+  bool writeUserBytes(RomCode rom_code, uint16_t user_bytes);
+
+  // Sets the calibration to apply to the readings of the thermometer with the
+  // specified rom code. Takes effect with the next conversion. The
+  // calibration is retained if the thermometer disappears from the bus and
+  // is later rediscovered.
+  void setCalibration(RomCode rom_code, const Calibration& calibration);
+
+  // Removes the calibration of the thermometer with the specified rom code.
+  void clearCalibration(RomCode rom_code);
+
+  // Sets the read priority of the thermometer with the specified rom code.
+  // After each conversion, the thermometers are read in the order of
+  // decreasing priority (and, within the same priority, by rom code). Those
+  // with a positive priority are delivered early, via
+  // EventListener::readingAvailable(), as soon as each one is read; then,
+  // the bus task yields, and reads the remaining thermometers in the next
+  // run. This way, the latency of the critical readings does not depend on
+  // the number of devices on the bus. Grouped conversions (see
+  // setMaxConcurrentConversions()) convert in the same order. Zero (the
+  // default) means no priority. Takes effect with the next conversion. The
+  // priority is retained if the thermometer disappears from the bus and is
+  // later rediscovered.
+  void setReadPriority(RomCode rom_code, int priority);
+
+  // Returns the read priority of the thermometer with the specified rom code.
+  int readPriority(RomCode rom_code) const {
+    auto itr = read_priorities_.find(rom_code);
+    return (itr == read_priorities_.end()) ? 0 : itr->second;
   }
 
+  // Returns the reading time of the most recent conversion, including
+  // selective ones (see updateSelected()).
   roo_time::Uptime lastReadingTime() const {
     return last_completed_conversion_;
   }
 
+  // Returns the reading time of the most recent conversion of all the
+  // thermometers.
+  roo_time::Uptime lastFullReadingTime() const {
+    return last_full_conversion_;
+  }
+
+  // Requests readings of all thermometers that are at most `max_age` old,
+  // and calls `callback` when they are available. If the most recent full
+  // conversion is fresh enough, the callback is called immediately.
+  // Otherwise, if a full conversion is in progress, the callback joins it;
+  // if a selective one is (see updateSelected()), a full conversion is
+  // started after it completes; if none is, a full conversion is started
+  // right away (see OneWire::update()). This way, many consumers with their
+  // own freshness requirements share a single bus cycle.
+  //
+  // The callback receives true if the readings are available, and false if
+  // the conversion could not be started (e.g. if no thermometers have been
+  // found on the bus).
+  void requestReading(roo_time::Interval max_age,
+                      std::function<void(bool)> callback);
+
   void addEventListener(EventListener* listener);
   void removeEventListener(EventListener* listener);
 
+  // By default, event listeners and reading callbacks are called directly
+  // from the bus task, so that a slow listener delays the subsequent bus
+  // operations. If deferred dispatch is enabled, the events are queued, and
+  // delivered from a separate scheduler task, which yields after spending
+  // `budget` in a single run. Listeners that individually take longer than
+  // `budget` get reported (see slowListenerCount()). Disabling deferred
+  // dispatch delivers the queued events immediately.
+  void setDeferredDispatch(bool enabled,
+                           roo_time::Interval budget = roo_time::Millis(5));
+
+  bool isDeferredDispatch() const { return deferred_dispatch_; }
+
+  // Returns true if there are queued events that have not yet been fully
+  // delivered.
+  bool hasPendingEvents() const {
+    return dispatching_ || pending_head_ < pending_events_.size();
+  }
+
+  // Returns the number of listener calls that exceeded the dispatch budget.
+  int slowListenerCount() const { return slow_listener_count_; }
+
+  BusState busState() const { return bus_state_; }
+
+  // Controls how the readings are fetched from the scratchpads.
+  enum ReadIntegrity {
+    // Reads all 9 bytes, and verifies the CRC.
+    READ_INTEGRITY_FULL,
+
+    // Reads only the 2 temperature bytes, followed by a reset that terminates
+    // the read. With Match ROM, this cuts the bus time per device by only
+    // about 31% (from 12.56 ms to 8.64 ms), as the reset and the addressing
+    // remain; it more than halves it (to 4.16 ms) only along with Skip ROM,
+    // on a single-device bus. Since these bytes are not covered by a CRC,
+    // the values are checked for plausibility (range, and the change since
+    // the previous reading), and verified by a full read if they fail the
+    // check. Each thermometer also gets a full read every 16 conversions.
+    READ_INTEGRITY_PARTIAL,
+  };
+
+  void setReadIntegrity(ReadIntegrity integrity) { read_integrity_ = integrity; }
+
+  ReadIntegrity readIntegrity() const { return read_integrity_; }
+
+  // If enabled (the default), DS28EA00 devices are addressed with Overdrive
+  // Match ROM (or Overdrive Skip ROM), and their scratchpads are read at
+  // overdrive speed, roughly 7 times faster than at standard speed.
+  // Conversions are requested at overdrive speed as well, when all devices on
+  // the bus are DS28EA00. Other devices stay at standard speed. If reads
+  // repeatedly fail at overdrive speed but succeed at standard speed (e.g.
+  // due to a long cable), overdrive gets suspended for a while, and then
+  // tried again.
+  void setOverdrive(bool enabled);
+
+  bool isOverdrive() const { return overdrive_enabled_; }
+
+  // Returns true if overdrive is enabled, but currently suspended, due to
+  // unreliable communication.
+  bool isOverdriveSuspended() const;
+
+  // Counters of scratchpad reads.
+  struct ReadStats {
+    // Reads of the entire scratchpad.
+    uint32_t full_reads;
+
+    // Reads of the temperature bytes only (see READ_INTEGRITY_PARTIAL).
+    uint32_t partial_reads;
+
+    // Reads (either kind) that used Skip ROM instead of Match ROM. Skip ROM
+    // is used when discovery finds exactly one device on the bus.
+    uint32_t skip_rom_reads;
+
+    // Partial reads that failed the plausibility check.
+    uint32_t implausible_reads;
+
+    // Reads that failed (bus or CRC errors, or the power-on reset value read
+    // again after a re-conversion).
+    uint32_t failed_reads;
+  };
+
+  const ReadStats& readStats() const { return read_stats_; }
+
+  void resetReadStats() { read_stats_ = ReadStats(); }
+
   // Returs true if a conversion is in progress. You can check when the
   // conversion will complete by calling getPendingConversionTime().
   bool isConversionPending() const {
@@ -122,47 +315,287 @@ class Thermometers {
     return pending_conversion_;
   }
 
+  // Returns when the library next needs to run: to read the results of the
+  // pending conversion (or of its next group, or the remainder of the reads),
+  // or to deliver queued events. While the bus is down, also returns the time
+  // at which update() probes the bus again. The duration is an estimate of
+  // the bus time needed.
+  Wakeup nextWakeup() const;
+
   const std::vector<RomCode>& rom_codes() const { return rom_codes_; }
 
+  // Returns the physical position, along the cable, of the thermometer with
+  // the specified index (0 being the nearest to the master), or -1 if
+  // unknown. Positions are known only when chain discovery is in use (see
+  // OneWire::setChainDiscovery()).
+  int physicalPosition(int idx) const {
+    return positions_.empty() ? -1 : positions_[idx];
+  }
+
+  // Returns the index of the thermometer at the specified physical position,
+  // or -1 if positions are not known, or if out of range.
+  int indexAtPhysicalPosition(int position) const {
+    if (position < 0) return -1;
+    for (int i = 0; i < (int)positions_.size(); ++i) {
+      if (positions_[i] == position) return i;
+    }
+    return -1;
+  }
+
+  // If enabled, and the bus is externally powered, update() issues the
+  // (broadcast) conversion request first, and then runs discovery while the
+  // conversion is in progress. This way, the readings become available
+  // sooner, by roughly the time it takes to search the bus. Has no effect on
+  // parasite-powered buses, where devices cannot communicate while
+  // converting. Disabled by default.
+  void setOverlapDiscoveryWithConversion(bool enabled) {
+    overlap_discovery_ = enabled;
+  }
+
+  bool isOverlapDiscoveryWithConversion() const { return overlap_discovery_; }
+
+  // Limits the number of thermometers that convert at the same time, to
+  // avoid browning out long or heavily loaded buses (which results in bogus
+  // power-on readings). When there are more thermometers than the limit,
+  // they are addressed individually (Match ROM) in groups. On externally
+  // powered buses, each group is read while the next one converts, so the
+  // total cycle takes about ceil(N / limit) conversion times. On
+  // parasite-powered buses, the strong pull-up blocks the bus for the
+  // duration of the conversion, so only one device can be started at a time,
+  // regardless of the limit. Zero (the default) means no limit, and uses a
+  // single broadcast conversion. Overlapping discovery with conversion (see
+  // above) is disabled when a limit is set.
+  void setMaxConcurrentConversions(int max) {
+    max_concurrent_conversions_ = max;
+  }
+
+  int maxConcurrentConversions() const { return max_concurrent_conversions_; }
+
+  // On parasite-powered buses, completion of the conversion cannot be polled,
+  // so update() waits for the worst-case 750 ms, even though most parts
+  // finish much sooner. If enabled, the actual conversion time gets measured
+  // once in a while (every 256 conversions), by polling the bus (releasing
+  // the strong pull-up for each poll slot only), and subsequent conversions
+  // wait for the measured time plus a safety margin. Before reading, a single read slot
+  // verifies that the conversion has actually completed; if it has not, or
+  // if any device returns the power-on reset value, the learned time is
+  // discarded, and the default applies until the next measurement. Has no
+  // effect on externally powered buses, or on grouped and selective
+  // conversions. Defaults to false.
+  void setConversionTimeLearning(bool enabled) {
+    learn_conversion_time_ = enabled;
+    learned_conversion_micros_ = 0;
+    cycles_until_calibration_ = 0;
+  }
+
+  bool isConversionTimeLearning() const { return learn_conversion_time_; }
+
+  // Returns the learned conversion time (including the safety margin), or
+  // zero if not known.
+  roo_time::Interval learnedConversionTime() const {
+    return roo_time::Micros(learned_conversion_micros_);
+  }
+
   ConstIterator begin() const { return ConstIterator(this, 0); }
   ConstIterator end() const { return ConstIterator(this, count()); }
 
  private:
   friend class OneWire;
 
-  struct ThermometerKeyFn {
-    const RomCode& operator()(const Thermometer& t) const {
-      return t.rom_code();
-    }
-  };
+  template <typename... Devices>
+  friend class StaticOneWire;
 
-  class ThermometersHT
-      : public roo_collections::FlatSmallHashtable<
-            Thermometer, RomCode, RomCodeHashFn, ThermometerKeyFn> {
-   public:
-    ConstIterator find(const RomCode& rom_code) const {
-      return roo_collections::FlatSmallHashtable<
-          Thermometer, RomCode, RomCodeHashFn,
-          ThermometerKeyFn>::find(rom_code);
-    }
-    Iterator find(const RomCode& rom_code) { return lookup(rom_code); }
+  // An event to be delivered to the listeners.
+  struct PendingEvent {
+    enum Type {
+      DISCOVERY_COMPLETED,
+      CONVERSION_COMPLETED,
+      BUS_STATE_CHANGED,
+      READING_AVAILABLE,
+    };
+
+    Type type;
+
+    // For conversions: whether the readings are available. Listeners are
+    // notified only about the successful ones.
+    bool success;
+
+    // For bus state changes: the new state.
+    BusState bus_state;
+
+    // For readings: the thermometer that has been read.
+    RomCode rom_code;
+
+    // Callbacks registered via requestReading(), for conversion events.
+    std::vector<std::function<void(bool)>> waiters;
   };
 
   Thermometers(OneWire& onewire, roo_scheduler::Scheduler& scheduler);
 
   Bus& bus();
 
+  BusArbiter& arbiter();
+
+  // Bus transactions (see BusArbiter) wrap these entry points.
   bool update();
+  bool updateInTransaction();
+
+  // Requests conversion only on the specified thermometers (using Match ROM),
+  // and reads only those when the conversion completes. Does not run
+  // discovery; rom codes that have not been discovered are ignored. On
+  // parasite-powered buses, where a device holding the strong pull-up blocks
+  // the bus, conversion of more than one device is requested by broadcast.
+  bool updateSelected(const RomCode* rom_codes, int count);
+  bool updateSelectedInTransaction(const RomCode* rom_codes, int count);
 
   void updateThermometers();
 
+  // How to address a device.
+  enum Addressing {
+    ADDRESSING_MATCH,
+    ADDRESSING_SKIP,
+    ADDRESSING_OVERDRIVE_MATCH,
+    ADDRESSING_OVERDRIVE_SKIP,
+  };
+
+  // Returns the cheapest way to address the specified device: Skip ROM if it
+  // is the only device on the bus, and at overdrive speed if supported.
+  Addressing addressing(RomCode rom_code) const;
+
+  // Returns true if overdrive is enabled, and not suspended.
+  bool useOverdrive() const;
+
+  // Sends the ROM command that addresses the device. Must follow a reset.
+  static void address(Bus& bus, RomCode rom_code, Addressing addressing);
+
+  // Reads the scratchpad, addressing the device as cheaply as possible, and
+  // updates read_stats_.
   bool readScratchpad(RomCode rom_code, Scratchpad& scratchpad);
 
+  static bool readScratchpad(Bus& bus, RomCode rom_code, Scratchpad& scratchpad,
+                             Addressing addressing = ADDRESSING_MATCH);
+
+  // Reads just the temperature bytes (0 and 1) of the scratchpad, and
+  // terminates the read with a reset. Sets `raw` to the (uncalibrated)
+  // temperature, in 1/16 °C. There is no CRC to verify the result.
+  bool readTemperatureBytes(const Thermometer& t, int16_t& raw);
+
+  // Returns true if the (uncalibrated) partial reading looks valid, given the
+  // previous reading of the thermometer.
+  bool isPlausible(const Thermometer& t, int16_t raw) const;
+
+  // Begins the conversion, and schedules the completion task.
+  bool startConversion();
+
   bool beginConversion();
 
+  // Requests conversion on the thermometers listed in selected_.
+  bool beginSelectedConversion();
+
+  // Reads the scratchpad of the thermometer at the specified index, updating
+  // its state. If the scratchpad contains the power-on reset value, the
+  // thermometer is added to power_on_resets_ instead. If the thermometer has
+  // a positive read priority, and the read succeeds, notifies the listeners
+  // right away (see EventListener::readingAvailable()).
+  void readThermometer(int idx, roo_time::Uptime reading_time);
+
+  // If the thermometer has a positive read priority, posts the event that
+  // its reading is available.
+  void notifyReadingAvailable(int idx);
+
+  // Reads the thermometers listed in `order`, starting at read_pos_. Once
+  // the prioritized ones have been read, re-schedules the completion task to
+  // read the rest, and returns false.
+  bool readInOrder(const std::vector<int>& order, roo_time::Uptime reading_time);
+
+  int readPriorityAt(int idx) const { return readPriority(rom_codes_[idx]); }
+
+  // Sorts the thermometer indexes by decreasing read priority, keeping the
+  // order of the ones with equal priority. Does not allocate.
+  void sortByReadPriority(std::vector<int>& indexes) const;
+
+  // Recomputes read_order_.
+  void updateReadOrder();
+
+  // If any thermometers returned the power-on reset value, converts them
+  // again, and returns true. The re-read values are accepted as they are.
+  bool reconvertPowerOnResets();
+
+  // If learning the conversion time, checks whether the conversion is
+  // complete, updating the learned time, or re-scheduling the completion task
+  // as needed. Returns true if the scratchpads can be read.
+  bool checkConversionTime();
+
+  // Delivers the event to the listeners, and, for conversions, to the
+  // reading waiters; either immediately, or via dispatch_task_.
+  void postEvent(PendingEvent::Type type, bool success,
+                 BusState bus_state = BUS_HEALTHY);
+  void postEvent(PendingEvent event);
+
+  // Clears the waiters of a delivered event, keeping their capacity in
+  // spare_waiters_.
+  void reclaimWaiters(PendingEvent& event);
+
+  // Calls the listener method corresponding to the event.
+  void deliver(const PendingEvent& event, const EventListener* listener) const;
+
+  // Delivers the queued events. If `bounded`, yields (re-scheduling
+  // dispatch_task_) after spending dispatch_budget_. Does nothing if called
+  // from within a listener; the outer call delivers the events posted
+  // meanwhile.
+  void dispatchEvents(bool bounded);
+
+  // Returns true if the discovered set is the same as the current one.
+  bool isUnchanged(const RomCodeSet& discovered) const;
+
+  // Replaces the thermometers with the discovered set, reading the
+  // scratchpads of the newly discovered ones.
+  void rebuild(const RomCodeSet& discovered);
+
+  // Returns the maximum number of devices to start converting at once when
+  // addressing them individually.
+  int maxGroupSize() const;
+
+  // Converts the thermometers listed in selected_, in groups of at most
+  // maxGroupSize().
+  bool startGroupedConversion();
+
+  // Requests conversion on the group starting at the specified position in
+  // selected_, and schedules the completion task.
+  bool beginGroup(int begin);
+
+  // Called when the current group has finished converting.
+  void groupCompleted();
+
+  // Updates the state, and notifies listeners, after all reads are done.
+  void finishConversion(roo_time::Uptime reading_time);
+
+  // Starts a full conversion for the requestReading() callbacks that could
+  // not join the selective one that has just completed.
+  void startFullCycleForWaiters();
+
+  // Schedules the completion task at the specified time.
+  void scheduleCompletion(roo_time::Uptime when);
+
   void conversionCompleted();
+  void conversionCompletedInTransaction();
+
+  // On a parasite-powered bus, holds the bus for the conversion (see
+  // BusArbiter::holdForConversion()) until the completion task is due, and
+  // ends the hold afterwards.
+  void updateConversionHold();
+
+  // If the bus is down, probes it, if it is time to do so. Returns true if the
+  // bus can be used.
+  bool checkBusUp();
+
+  // Updates the bus state after a transaction. `cycle_completed` indicates
+  // whether the transaction has completed a conversion.
+  void updateBusState(bool cycle_completed);
 
-  bool initThermometer(RomCode rom_code, const Scratchpad& scratchpad,
+  void setBusState(BusState state);
+
+  static bool initThermometer(RomCode rom_code, const Scratchpad& scratchpad,
                        Thermometer& t, bool post_conversion);
 
   void readPowerSupply();
@@ -173,21 +606,187 @@ class Thermometers {
   // When did the last conversion finish.
   roo_time::Uptime last_completed_conversion_;
 
+  // When did the last conversion of all thermometers finish.
+  roo_time::Uptime last_full_conversion_;
+
   // When will the current conversion finish. Zero means none is pending.
   roo_time::Uptime pending_conversion_;
 
   // Whether the bus uses parasite power. Auto-detected.
   bool parasite_;
 
+  // Whether the pending conversion covers all thermometers (possibly in
+  // groups), as opposed to those passed to updateSelected().
+  bool full_cycle_;
+
+  // Whether the pending conversion is limited to selected_.
+  bool selective_;
+
+  // Indexes of thermometers selected for conversion, if selective_.
+  std::vector<int> selected_;
+
+  // Maximum number of concurrent conversions; zero means no limit.
+  int max_concurrent_conversions_;
+
+  // Whether the pending conversion proceeds in groups.
+  bool grouped_;
+
+  // Range of selected_ that is currently converting, if grouped_.
+  int group_begin_;
+  int group_end_;
+
+  // When the currently converting group will finish, if grouped_.
+  roo_time::Uptime group_completion_;
+
+  // Thermometers that returned the power-on reset value in the current cycle.
+  std::vector<int> power_on_resets_;
+
+  // Whether the pending conversion re-converts power_on_resets_.
+  bool reconverting_;
+
+  // Whether to learn the conversion time on parasite buses.
+  bool learn_conversion_time_;
+
+  // Learned conversion time, including the safety margin; zero if unknown.
+  int32_t learned_conversion_micros_;
+
+  // Whether the pending conversion measures the conversion time.
+  bool calibrating_;
+
+  // Whether the pending conversion uses the learned conversion time.
+  bool using_learned_conversion_time_;
+
+  // Number of conversions remaining until the next measurement.
+  int cycles_until_calibration_;
+
+  // When the pending broadcast conversion has been requested.
+  roo_time::Uptime conversion_start_;
+
+  // Whether the bus has exactly one device, which can be addressed with Skip
+  // ROM.
+  bool single_device_;
+
+  BusState bus_state_;
+
+  // Number of consecutive clean conversions, while degraded.
+  int clean_cycles_;
+
+  // While the bus is down: the current backoff, and the next probe time.
+  roo_time::Interval probe_backoff_;
+  roo_time::Uptime next_probe_;
+
+  // Whether the bus is held for the pending conversion (see
+  // updateConversionHold()).
+  bool holding_bus_;
+
+  // Whether to talk to the DS28EA00 devices at overdrive speed.
+  bool overdrive_enabled_;
+
+  // Number of consecutive reads that failed at overdrive speed, but
+  // succeeded at standard speed.
+  int overdrive_fallbacks_;
+
+  // Until when overdrive is suspended, after too many fallbacks.
+  roo_time::Uptime overdrive_suspended_until_;
+
+  // Whether all devices on the bus are DS28EA00, so that broadcasts can use
+  // overdrive.
+  bool all_overdrive_capable_;
+
+  ReadIntegrity read_integrity_;
+
+  // Number of completed conversions; staggers the periodic full reads.
+  uint32_t read_cycle_;
+
+  ReadStats read_stats_;
+
+  // Whether to run discovery while the conversion is in progress.
+  bool overlap_discovery_;
+
   roo_scheduler::SingletonTask conversion_completion_task_;
 
+  // When the completion task is scheduled to run; Uptime::Max() if not.
+  roo_time::Uptime next_completion_;
+
   // List of discovered rom codes, sorted ascending.
   std::vector<RomCode> rom_codes_;
 
+  // Discovered thermometers, in the same order as rom_codes_.
+  std::vector<Thermometer> thermometers_;
+
+  // Scratch space for discovery; kept to reuse the capacity.
+  std::vector<Thermometer> discovered_thermometers_;
+
+  // Physical positions of the thermometers, in the same order as rom_codes_;
+  // empty if unknown.
+  std::vector<int> positions_;
+
   // Map that allows retrieval of thermometers by rom code.
-  ThermometersHT thermometers_;
+  roo_collections::FlatSmallHashMap<RomCode, int, RomCodeHashFn>
+      idx_by_rom_code_;
+
+  // Calibrations, by rom code. Copied to the thermometers upon discovery.
+  roo_collections::FlatSmallHashMap<RomCode, Calibration, RomCodeHashFn>
+      calibrations_;
+
+  // Read priorities, by rom code; zero if absent.
+  roo_collections::FlatSmallHashMap<RomCode, int, RomCodeHashFn>
+      read_priorities_;
+
+  // Indexes of the thermometers, in the order of reading after a broadcast
+  // conversion. Recomputed when the conversion starts.
+  std::vector<int> read_order_;
+
+  // Position, in the read order, of the next thermometer to read, if the
+  // reads have been split across runs of the completion task; zero
+  // otherwise.
+  int read_pos_;
 
   roo_collections::FlatSmallHashSet<EventListener*> event_listeners_;
+
+  // Callbacks waiting for the pending conversion (see requestReading()).
+  std::vector<std::function<void(bool)>> reading_waiters_;
+
+  // Callbacks waiting for a full conversion to start, after the pending
+  // selective one.
+  std::vector<std::function<void(bool)>> full_cycle_waiters_;
+
+  // Whether events are delivered from dispatch_task_.
+  bool deferred_dispatch_;
+
+  // Maximum time that a single run of dispatch_task_ spends in listeners.
+  roo_time::Interval dispatch_budget_;
+
+  // Spare capacity for reading_waiters_, handed over to the events, and
+  // returned once they have been delivered.
+  std::vector<std::function<void(bool)>> spare_waiters_;
+
+  // Queued events, oldest first, starting at pending_head_. The storage is
+  // reused once drained.
+  std::vector<PendingEvent> pending_events_;
+
+  size_t pending_head_;
+
+  // The event being delivered, moved out of pending_events_, so that
+  // listeners can post further events in the meantime.
+  PendingEvent dispatched_event_;
+
+  // Whether dispatched_event_ is being delivered.
+  bool dispatching_;
+
+  // Whether dispatchEvents() is running.
+  bool in_dispatch_;
+
+  // Listeners of the event being delivered (nullptr for the removed ones).
+  std::vector<const EventListener*> dispatch_listeners_;
+
+  // Position of the next listener (followed by the waiters) to call, for the
+  // event being delivered.
+  size_t dispatch_listener_pos_;
+
+  int slow_listener_count_;
+
+  roo_scheduler::SingletonTask dispatch_task_;
 };
 
 }  // namespace roo_onewire
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "roo_onewire/thermometers/calibration.h"
+
+#include "roo_logging.h"
+
+namespace roo_onewire {
+
+Calibration Calibration::TwoPoint(int16_t measured_low, int16_t actual_low,
+                                  int16_t measured_high, int16_t actual_high) {
+  if (measured_low == kUnknownRawTemperature ||
+      actual_low == kUnknownRawTemperature ||
+      measured_high == kUnknownRawTemperature ||
+      actual_high == kUnknownRawTemperature) {
+    LOG(ERROR) << "Invalid calibration: unknown temperature";
+    return Calibration();
+  }
+  if (measured_low == measured_high) {
+    LOG(ERROR) << "Invalid calibration: both points measured at "
+               << measured_low;
+    return Calibration();
+  }
+  int64_t gain_q16 = ((int64_t)(actual_high - actual_low) << 16) /
+                     (measured_high - measured_low);
+  return Calibration(measured_low, actual_low, (int32_t)gain_q16);
+}
+
+Calibration Calibration::TwoPoint(roo_temperature::Temperature measured_low,
+                                  roo_temperature::Temperature actual_low,
+                                  roo_temperature::Temperature measured_high,
+                                  roo_temperature::Temperature actual_high) {
+  return TwoPoint(TemperatureToRaw(measured_low), TemperatureToRaw(actual_low),
+                  TemperatureToRaw(measured_high),
+                  TemperatureToRaw(actual_high));
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include "roo_onewire/thermometers/raw_temperature.h"
+#include "roo_temperature.h"
+
+namespace roo_onewire {
+
+// Linear correction of raw thermometer readings, applied in integer
+// arithmetic. All raw values are in 1/16 °C.
+class Calibration {
+ public:
+  // Identity (no correction).
+  Calibration() : measured_ref_(0), actual_ref_(0), gain_q16_(1L << 16) {}
+
+  // Adds a constant offset to all readings.
+  static Calibration Offset(int16_t offset) {
+    return Calibration(0, offset, 1L << 16);
+  }
+
+  // Maps `measured_low` to `actual_low`, and `measured_high` to
+  // `actual_high`, interpolating (and extrapolating) linearly.
+  static Calibration TwoPoint(int16_t measured_low, int16_t actual_low,
+                              int16_t measured_high, int16_t actual_high);
+
+  // Convenience variant of the above, taking regular temperatures. (Performs
+  // floating-point conversion once, when called.)
+  static Calibration TwoPoint(roo_temperature::Temperature measured_low,
+                              roo_temperature::Temperature actual_low,
+                              roo_temperature::Temperature measured_high,
+                              roo_temperature::Temperature actual_high);
+
+  bool isIdentity() const {
+    return actual_ref_ == measured_ref_ && gain_q16_ == (1L << 16);
+  }
+
+  // Returns the corrected reading. Unknown stays unknown.
+  int16_t apply(int16_t raw) const {
+    if (raw == kUnknownRawTemperature) return raw;
+    int64_t result = actual_ref_ + (((int64_t)(raw - measured_ref_) * gain_q16_ +
+                                     (1L << 15)) >>
+                                    16);
+    if (result <= INT16_MIN) return INT16_MIN + 1;
+    if (result > INT16_MAX) return INT16_MAX;
+    return (int16_t)result;
+  }
+
+ private:
+  Calibration(int16_t measured_ref, int16_t actual_ref, int32_t gain_q16)
+      : measured_ref_(measured_ref),
+        actual_ref_(actual_ref),
+        gain_q16_(gain_q16) {}
+
+  int16_t measured_ref_;
+  int16_t actual_ref_;
+
+  // Slope, as a Q16 fixed-point number.
+  int32_t gain_q16_;
+};
+
+}  // namespace roo_onewire
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <inttypes.h>
+
+#include "roo_onewire/device_family.h"
+#include "roo_onewire/thermometers/resolution.h"
+
+namespace roo_onewire {
+
+// Returns the maximum conversion time, per datasheets, of a thermometer of the
+// specified family, configured with the specified resolution.
+constexpr int32_t ConversionTimeMicros(DeviceFamily family,
+                                       Resolution resolution) {
+  return family == DEVICE_FAMILY_MAX31850 ? 100000
+         : (family == DEVICE_FAMILY_DS18S20 ||
+            resolution < RESOLUTION_9_BITS || resolution > RESOLUTION_12_BITS)
+             ? 750000
+             : (750000 >> (RESOLUTION_12_BITS - resolution));
+}
+
+}  // namespace roo_onewire
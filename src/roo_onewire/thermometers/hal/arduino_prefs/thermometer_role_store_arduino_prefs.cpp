@@ -1,12 +1,27 @@
 #include "thermometer_role_store_arduino_prefs.h"
 
-#include <cstdio>
-
 namespace roo_onewire {
 
 namespace {
 
-void id2key(int id, char* key) { sprintf(key, "r_%d", id); }
+// Formats the key as "r_<id>".
+void id2key(int id, char* key) {
+  *key++ = 'r';
+  *key++ = '_';
+  unsigned int val = id;
+  if (id < 0) {
+    *key++ = '-';
+    val = -val;
+  }
+  char digits[10];
+  int n = 0;
+  do {
+    digits[n++] = '0' + val % 10;
+    val /= 10;
+  } while (val > 0);
+  while (n > 0) *key++ = digits[--n];
+  *key = '\0';
+}
 
 }  // namespace
 
@@ -32,4 +47,29 @@ void ArduinoPreferencesThermometerRoleStore::clearRomCode(int id) {
   t.store().remove(key);
 }
 
+void ArduinoPreferencesThermometerRoleStore::getRomCodes(const int* ids,
+                                                         RomCode* rom_codes,
+                                                         int count) {
+  roo_prefs::Transaction t(collection_, true);
+  char key[16];
+  for (int i = 0; i < count; ++i) {
+    id2key(ids[i], key);
+    rom_codes[i] = RomCode(t.store().getULong64(key, 0));
+  }
+}
+
+void ArduinoPreferencesThermometerRoleStore::setRomCodes(
+    const int* ids, const RomCode* rom_codes, int count) {
+  roo_prefs::Transaction t(collection_);
+  char key[16];
+  for (int i = 0; i < count; ++i) {
+    id2key(ids[i], key);
+    if (rom_codes[i].isUnknown()) {
+      t.store().remove(key);
+    } else {
+      t.store().putULong64(key, rom_codes[i].raw());
+    }
+  }
+}
+
 }  // namespace roo_onewire
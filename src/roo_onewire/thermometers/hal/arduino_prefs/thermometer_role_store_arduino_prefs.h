@@ -13,6 +13,12 @@ class ArduinoPreferencesThermometerRoleStore : public ThermometerRoleStore {
   void setRomCode(int id, roo_onewire::RomCode rom_code) override;
   void clearRomCode(int id) override;
 
+  // Use a single transaction for all roles.
+  void getRomCodes(const int* ids, roo_onewire::RomCode* rom_codes,
+                   int count) override;
+  void setRomCodes(const int* ids, const roo_onewire::RomCode* rom_codes,
+                   int count) override;
+
  private:
   roo_prefs::Collection collection_;
 };
@@ -0,0 +1,98 @@
+#include "roo_onewire/thermometers/hal/coalescing_thermometer_role_store.h"
+
+#include <vector>
+
+#include "roo_logging.h"
+
+namespace roo_onewire {
+
+CoalescingThermometerRoleStore::CoalescingThermometerRoleStore(
+    ThermometerRoleStore& delegate, roo_scheduler::Scheduler& scheduler,
+    roo_time::Interval commit_delay)
+    : delegate_(delegate),
+      dirty_count_(0),
+      commit_task_(scheduler, [this]() { commit(); }),
+      commit_delay_(commit_delay) {
+  CHECK(!delegate.isStoredOnDevices())
+      << "Cannot cache assignments that are stored on the devices";
+}
+
+CoalescingThermometerRoleStore::~CoalescingThermometerRoleStore() { commit(); }
+
+RomCode CoalescingThermometerRoleStore::getRomCode(int id) {
+  RomCode rom_code;
+  getRomCodes(&id, &rom_code, 1);
+  return rom_code;
+}
+
+void CoalescingThermometerRoleStore::setRomCode(int id, RomCode rom_code) {
+  put(id, rom_code);
+}
+
+void CoalescingThermometerRoleStore::clearRomCode(int id) {
+  put(id, RomCode());
+}
+
+void CoalescingThermometerRoleStore::getRomCodes(const int* ids,
+                                                 RomCode* rom_codes,
+                                                 int count) {
+  std::vector<int> missing;
+  for (int i = 0; i < count; ++i) {
+    auto itr = cache_.find(ids[i]);
+    if (itr == cache_.end()) {
+      missing.push_back(ids[i]);
+    } else {
+      rom_codes[i] = itr->second.rom_code;
+    }
+  }
+  if (missing.empty()) return;
+  std::vector<RomCode> loaded(missing.size());
+  delegate_.getRomCodes(&missing[0], &loaded[0], missing.size());
+  for (size_t i = 0; i < missing.size(); ++i) {
+    cache_[missing[i]] = Entry{loaded[i], false};
+  }
+  for (int i = 0; i < count; ++i) {
+    rom_codes[i] = cache_[ids[i]].rom_code;
+  }
+}
+
+void CoalescingThermometerRoleStore::setRomCodes(const int* ids,
+                                                 const RomCode* rom_codes,
+                                                 int count) {
+  for (int i = 0; i < count; ++i) {
+    put(ids[i], rom_codes[i]);
+  }
+}
+
+void CoalescingThermometerRoleStore::put(int id, RomCode rom_code) {
+  auto itr = cache_.find(id);
+  if (itr != cache_.end() && itr->second.rom_code == rom_code) return;
+  Entry& entry = cache_[id];
+  entry.rom_code = rom_code;
+  if (!entry.dirty) {
+    entry.dirty = true;
+    if (dirty_count_++ == 0) {
+      commit_task_.scheduleAfter(commit_delay_);
+    }
+  }
+}
+
+void CoalescingThermometerRoleStore::commit() {
+  if (dirty_count_ == 0) return;
+  std::vector<int> ids;
+  std::vector<RomCode> rom_codes;
+  ids.reserve(dirty_count_);
+  rom_codes.reserve(dirty_count_);
+  for (const auto& i : cache_) {
+    if (!i.second.dirty) continue;
+    ids.push_back(i.first);
+    rom_codes.push_back(i.second.rom_code);
+  }
+  for (int id : ids) {
+    cache_[id].dirty = false;
+  }
+  dirty_count_ = 0;
+  delegate_.setRomCodes(&ids[0], &rom_codes[0], ids.size());
+}
+
+}  // namespace roo_onewire
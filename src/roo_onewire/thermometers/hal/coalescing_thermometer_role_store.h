@@ -0,0 +1,60 @@
+#pragma once
+
+#include "roo_collections/flat_small_hash_map.h"
+#include "roo_onewire/thermometers/hal/thermometer_role_store.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+
+namespace roo_onewire {
+
+// Wraps another store, caching the assignments in memory, and deferring the
+// writes so that a burst of (re)assignments results in a single, bulk update
+// of the underlying store (e.g. a single flash commit).
+//
+// The underlying store must keep the assignments in the controller (i.e.,
+// not isStoredOnDevices()); the assignments kept on the devices change with
+// every discovery, which would make the cache stale.
+class CoalescingThermometerRoleStore : public ThermometerRoleStore {
+ public:
+  CoalescingThermometerRoleStore(
+      ThermometerRoleStore& delegate, roo_scheduler::Scheduler& scheduler,
+      roo_time::Interval commit_delay = roo_time::Millis(500));
+
+  // Writes any pending changes.
+  ~CoalescingThermometerRoleStore();
+
+  RomCode getRomCode(int id) override;
+  void setRomCode(int id, RomCode rom_code) override;
+  void clearRomCode(int id) override;
+
+  void getRomCodes(const int* ids, RomCode* rom_codes, int count) override;
+  void setRomCodes(const int* ids, const RomCode* rom_codes,
+                   int count) override;
+
+  // Writes pending changes to the underlying store immediately.
+  void commit();
+
+  // Returns true if there are changes that have not been written yet.
+  bool hasPendingChanges() const { return dirty_count_ > 0; }
+
+ private:
+  struct Entry {
+    Entry() : rom_code(), dirty(false) {}
+    Entry(RomCode rom_code, bool dirty) : rom_code(rom_code), dirty(dirty) {}
+
+    RomCode rom_code;
+
+    // Whether the entry needs to be written to the underlying store.
+    bool dirty;
+  };
+
+  void put(int id, RomCode rom_code);
+
+  ThermometerRoleStore& delegate_;
+  roo_collections::FlatSmallHashMap<int, Entry> cache_;
+  int dirty_count_;
+  roo_scheduler::SingletonTask commit_task_;
+  roo_time::Interval commit_delay_;
+};
+
+}  // namespace roo_onewire
@@ -0,0 +1,159 @@
+#include "thermometer_role_store_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "roo_logging.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// File format: the magic, followed by a 32-bit record count, followed by the
+// records, each consisting of a 32-bit id and a 64-bit rom code. All values
+// are little-endian.
+static const uint8_t kMagic[4] = {'R', '1', 'W', 'R'};
+
+void EncodeLE(uint64_t val, int bytes, uint8_t* out) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = val >> (8 * i);
+  }
+}
+
+uint64_t DecodeLE(const uint8_t* in, int bytes) {
+  uint64_t val = 0;
+  for (int i = 0; i < bytes; ++i) {
+    val |= ((uint64_t)in[i]) << (8 * i);
+  }
+  return val;
+}
+
+}  // namespace
+
+FileThermometerRoleStore::FileThermometerRoleStore(std::string path)
+    : path_(std::move(path)), loaded_(false) {}
+
+RomCode FileThermometerRoleStore::getRomCode(int id) {
+  load();
+  return find(id);
+}
+
+void FileThermometerRoleStore::setRomCode(int id, RomCode rom_code) {
+  setRomCodes(&id, &rom_code, 1);
+}
+
+void FileThermometerRoleStore::clearRomCode(int id) {
+  RomCode unknown;
+  setRomCodes(&id, &unknown, 1);
+}
+
+void FileThermometerRoleStore::getRomCodes(const int* ids, RomCode* rom_codes,
+                                           int count) {
+  load();
+  for (int i = 0; i < count; ++i) {
+    rom_codes[i] = find(ids[i]);
+  }
+}
+
+void FileThermometerRoleStore::setRomCodes(const int* ids,
+                                           const RomCode* rom_codes,
+                                           int count) {
+  load();
+  bool changed = false;
+  for (int i = 0; i < count; ++i) {
+    changed |= put(ids[i], rom_codes[i]);
+  }
+  if (changed) save();
+}
+
+RomCode FileThermometerRoleStore::find(int id) const {
+  auto itr = std::lower_bound(
+      entries_.begin(), entries_.end(), id,
+      [](const Entry& e, int id) { return e.id < id; });
+  return (itr == entries_.end() || itr->id != id) ? RomCode()
+                                                  : RomCode(itr->rom_code);
+}
+
+bool FileThermometerRoleStore::put(int id, RomCode rom_code) {
+  auto itr = std::lower_bound(
+      entries_.begin(), entries_.end(), id,
+      [](const Entry& e, int id) { return e.id < id; });
+  bool found = (itr != entries_.end() && itr->id == id);
+  if (rom_code.isUnknown()) {
+    if (!found) return false;
+    entries_.erase(itr);
+    return true;
+  }
+  if (found) {
+    if (itr->rom_code == rom_code.raw()) return false;
+    itr->rom_code = rom_code.raw();
+    return true;
+  }
+  entries_.insert(itr, Entry{id, rom_code.raw()});
+  return true;
+}
+
+void FileThermometerRoleStore::load() {
+  if (loaded_) return;
+  loaded_ = true;
+  entries_.clear();
+  FILE* f = fopen(path_.c_str(), "rb");
+  if (f == nullptr) return;
+  uint8_t header[8];
+  if (fread(header, 1, 8, f) != 8 || memcmp(header, kMagic, 4) != 0) {
+    LOG(ERROR) << "Ignoring malformed role file " << path_;
+    fclose(f);
+    return;
+  }
+  uint32_t count = DecodeLE(header + 4, 4);
+  // The count must agree with the file size; don't trust it otherwise (e.g.
+  // to reserve memory).
+  long size = (fseek(f, 0, SEEK_END) == 0) ? ftell(f) : -1;
+  if (size < 0 || (uint64_t)size != 8 + 12 * (uint64_t)count ||
+      fseek(f, 8, SEEK_SET) != 0) {
+    LOG(ERROR) << "Ignoring corrupt role file " << path_;
+    fclose(f);
+    return;
+  }
+  entries_.reserve(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint8_t record[12];
+    if (fread(record, 1, 12, f) != 12) {
+      LOG(ERROR) << "Failed to read role file " << path_;
+      entries_.clear();
+      break;
+    }
+    entries_.push_back(
+        Entry{(int32_t)DecodeLE(record, 4), DecodeLE(record + 4, 8)});
+  }
+  fclose(f);
+  std::sort(entries_.begin(), entries_.end(),
+            [](const Entry& a, const Entry& b) { return a.id < b.id; });
+}
+
+void FileThermometerRoleStore::save() {
+  std::string tmp_path = path_ + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "wb");
+  if (f == nullptr) {
+    LOG(ERROR) << "Failed to open role file " << tmp_path << " for writing";
+    return;
+  }
+  std::vector<uint8_t> buf(8 + 12 * entries_.size());
+  memcpy(&buf[0], kMagic, 4);
+  EncodeLE(entries_.size(), 4, &buf[4]);
+  uint8_t* out = &buf[8];
+  for (const Entry& e : entries_) {
+    EncodeLE((uint32_t)e.id, 4, out);
+    EncodeLE(e.rom_code, 8, out + 4);
+    out += 12;
+  }
+  bool ok = (fwrite(&buf[0], 1, buf.size(), f) == buf.size());
+  ok &= (fclose(f) == 0);
+  if (!ok || rename(tmp_path.c_str(), path_.c_str()) != 0) {
+    LOG(ERROR) << "Failed to write role file " << path_;
+    remove(tmp_path.c_str());
+  }
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "roo_onewire/thermometers/hal/thermometer_role_store.h"
+
+namespace roo_onewire {
+
+// Keeps the role assignments in a binary file. Intended primarily for Linux
+// (e.g. for testing and benchmarking configurations with many roles off the
+// device), but works on any platform with a stdio-compatible file system.
+//
+// The entire table is loaded into memory on first access, and kept sorted by
+// role ID. Every write rewrites the file atomically (via a temporary file and
+// a rename). Wrap in CoalescingThermometerRoleStore to turn bursts of
+// assignments into a single write.
+class FileThermometerRoleStore : public ThermometerRoleStore {
+ public:
+  FileThermometerRoleStore(std::string path);
+
+  RomCode getRomCode(int id) override;
+  void setRomCode(int id, RomCode rom_code) override;
+  void clearRomCode(int id) override;
+
+  void getRomCodes(const int* ids, RomCode* rom_codes, int count) override;
+  void setRomCodes(const int* ids, const RomCode* rom_codes,
+                   int count) override;
+
+ private:
+  struct Entry {
+    int32_t id;
+    uint64_t rom_code;
+  };
+
+  void load();
+  void save();
+
+  // Updates the in-memory table. Returns true if the table has changed.
+  bool put(int id, RomCode rom_code);
+
+  RomCode find(int id) const;
+
+  std::string path_;
+  bool loaded_;
+
+  // Sorted by id. Contains only assigned roles.
+  std::vector<Entry> entries_;
+};
+
+}  // namespace roo_onewire
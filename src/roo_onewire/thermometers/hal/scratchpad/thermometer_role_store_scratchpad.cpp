@@ -0,0 +1,73 @@
+#include "thermometer_role_store_scratchpad.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// TL is set to TH xor'ed with this marker, so that the factory defaults (and
+// other arbitrary alarm settings) are unlikely to be mistaken for a role.
+static const uint8_t kMarker = 0x5A;
+
+// Factory defaults of TH and TL; written back when a role is cleared.
+static const uint16_t kUnassigned = 0x4B46;
+
+bool Encode(int id, uint16_t& user_bytes) {
+  if (id < 0 || id >= 0xFF) return false;
+  user_bytes = (id << 8) | (id ^ kMarker);
+  return true;
+}
+
+int Decode(uint16_t user_bytes) {
+  uint8_t th = user_bytes >> 8;
+  uint8_t tl = user_bytes & 0xFF;
+  return (th != 0xFF && (th ^ kMarker) == tl) ? th : -1;
+}
+
+}  // namespace
+
+RomCode ScratchpadThermometerRoleStore::getRomCode(int id) {
+  for (const auto& t : onewire_.thermometers()) {
+    if (t.hasUserBytes() && Decode(t.user_bytes()) == id) {
+      return t.rom_code();
+    }
+  }
+  return RomCode();
+}
+
+void ScratchpadThermometerRoleStore::setRomCode(int id, RomCode rom_code) {
+  uint16_t user_bytes;
+  if (!Encode(id, user_bytes)) {
+    LOG(ERROR) << "Role ID " << id << " can't be stored in the scratchpad";
+    return;
+  }
+  // Assign the new holder first, so that a failed write leaves the previous
+  // assignment intact.
+  if (!onewire_.thermometers().writeUserBytes(rom_code, user_bytes)) {
+    LOG(ERROR) << "Assigning role " << id << " to " << rom_code << " failed";
+    return;
+  }
+  // Make sure that no other device claims the same role.
+  clearRomCodeExcept(id, rom_code);
+}
+
+void ScratchpadThermometerRoleStore::clearRomCode(int id) {
+  clearRomCodeExcept(id, RomCode());
+}
+
+void ScratchpadThermometerRoleStore::clearRomCodeExcept(int id,
+                                                        RomCode holder) {
+  Thermometers& thermometers = onewire_.thermometers();
+  for (int i = 0; i < thermometers.count(); ++i) {
+    const Thermometer& t = thermometers.thermometer(i);
+    if (t.rom_code() == holder || !t.hasUserBytes() ||
+        Decode(t.user_bytes()) != id) {
+      continue;
+    }
+    if (!thermometers.writeUserBytes(t.rom_code(), kUnassigned)) {
+      LOG(ERROR) << "Clearing role " << id << " from " << t.rom_code()
+                 << " failed";
+    }
+  }
+}
+
+}  // namespace roo_onewire
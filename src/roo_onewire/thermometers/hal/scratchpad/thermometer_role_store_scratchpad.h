@@ -0,0 +1,38 @@
+#pragma once
+
+#include "roo_onewire.h"
+#include "roo_onewire/thermometers/hal/thermometer_role_store.h"
+
+namespace roo_onewire {
+
+// Keeps the role assignments on the thermometers themselves, encoded in their
+// TH and TL registers (which are backed by the device EEPROM). Roles are
+// resolved directly from the scratchpad contents that are read during
+// discovery, so that no flash access is needed at startup, and a thermometer
+// moved to a different controller retains its role.
+//
+// Supports role IDs in the range [0, 255). Devices without user bytes (e.g.
+// MAX31850) cannot be assigned roles. Since the TH and TL registers double as
+// alarm thresholds, alarm search is meaningless for devices managed by this
+// store.
+//
+// Roles assigned to thermometers that are not present on the bus are reported
+// as unassigned.
+class ScratchpadThermometerRoleStore : public ThermometerRoleStore {
+ public:
+  ScratchpadThermometerRoleStore(OneWire& onewire) : onewire_(onewire) {}
+
+  RomCode getRomCode(int id) override;
+  void setRomCode(int id, RomCode rom_code) override;
+  void clearRomCode(int id) override;
+
+  bool isStoredOnDevices() const override { return true; }
+
+ private:
+  // Clears the role from all devices but `holder`.
+  void clearRomCodeExcept(int id, RomCode holder);
+
+  OneWire& onewire_;
+};
+
+}  // namespace roo_onewire
@@ -7,9 +7,42 @@ namespace roo_onewire {
 // Stores (e.g. in Preferences) the mapping from IDs to rom codes.
 class ThermometerRoleStore {
  public:
+  virtual ~ThermometerRoleStore() = default;
+
   virtual RomCode getRomCode(int id) = 0;
   virtual void setRomCode(int id, RomCode rom_code) = 0;
   virtual void clearRomCode(int id) = 0;
+
+  // Retrieves rom codes assigned to the `count` roles with the specified
+  // `ids`, storing them in the corresponding entries of `rom_codes`. Roles
+  // that are not assigned get the unknown rom code. The default implementation
+  // calls getRomCode() for each role; stores that can do better (e.g. using a
+  // single transaction) should override it.
+  virtual void getRomCodes(const int* ids, RomCode* rom_codes, int count) {
+    for (int i = 0; i < count; ++i) {
+      rom_codes[i] = getRomCode(ids[i]);
+    }
+  }
+
+  // Stores rom codes for the `count` roles with the specified `ids`. An
+  // unknown rom code clears the assignment. The default implementation calls
+  // setRomCode() or clearRomCode() for each role; stores that can do better
+  // (e.g. using a single transaction) should override it.
+  virtual void setRomCodes(const int* ids, const RomCode* rom_codes,
+                           int count) {
+    for (int i = 0; i < count; ++i) {
+      if (rom_codes[i].isUnknown()) {
+        clearRomCode(ids[i]);
+      } else {
+        setRomCode(ids[i], rom_codes[i]);
+      }
+    }
+  }
+
+  // Returns true if the mapping is kept on the devices themselves, rather than
+  // in the controller. Such mapping can only be resolved for devices that are
+  // present on the bus, so it needs to be reloaded after every discovery.
+  virtual bool isStoredOnDevices() const { return false; }
 };
 
 }  // namespace roo_onewire
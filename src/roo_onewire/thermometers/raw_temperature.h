@@ -0,0 +1,34 @@
+#pragma once
+
+#include <inttypes.h>
+#include <math.h>
+
+#include "roo_temperature.h"
+
+namespace roo_onewire {
+
+// Temperature readings are kept as signed fixed-point integers, in 1/16 °C
+// (the native unit of most OneWire thermometers), and converted to
+// roo_temperature::Temperature only when requested.
+
+// Raw value that denotes an unknown temperature.
+static const int16_t kUnknownRawTemperature = INT16_MIN;
+
+inline roo_temperature::Temperature RawToTemperature(int16_t raw) {
+  return raw == kUnknownRawTemperature
+             ? roo_temperature::Unknown()
+             : roo_temperature::DegCelcius((float)raw / 16.0f);
+}
+
+// Converts to the raw value, rounding to the nearest 1/16 °C. Unknown (or
+// NaN) converts to kUnknownRawTemperature; values out of range are clamped.
+inline int16_t TemperatureToRaw(roo_temperature::Temperature t) {
+  if (t.isUnknown()) return kUnknownRawTemperature;
+  float raw = t.degCelcius() * 16.0f;
+  if (isnan(raw)) return kUnknownRawTemperature;
+  if (raw <= (float)(INT16_MIN + 1)) return INT16_MIN + 1;
+  if (raw >= (float)INT16_MAX) return INT16_MAX;
+  return (int16_t)lroundf(raw);
+}
+
+}  // namespace roo_onewire
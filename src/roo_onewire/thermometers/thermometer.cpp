@@ -5,7 +5,10 @@ namespace roo_onewire {
 Thermometer::Thermometer()
     : family_(DEVICE_FAMILY_UNKNOWN),
       resolution_(RESOLUTION_UNDEFINED),
-      temperature_(roo_temperature::Unknown()) {}
+      user_bytes_(0),
+      raw_temperature_(kUnknownRawTemperature),
+      reading_time_(roo_time::Uptime::Start()),
+      calibration_() {}
 
 roo_logging::Stream& operator<<(roo_logging::Stream& os, const Thermometer& t) {
   os << "{rom_code: " << t.rom_code() << ", family: " << t.family()
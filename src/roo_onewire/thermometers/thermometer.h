@@ -5,11 +5,17 @@
 #include "roo_logging.h"
 #include "roo_onewire/device_family.h"
 #include "roo_onewire/rom_code.h"
+#include "roo_onewire/thermometers/calibration.h"
+#include "roo_onewire/thermometers/raw_temperature.h"
 #include "roo_onewire/thermometers/resolution.h"
 #include "roo_temperature.h"
+#include "roo_time.h"
 
 namespace roo_onewire {
 
+template <typename... Devices>
+class StaticOneWire;
+
 class Thermometer {
  public:
   Thermometer();
@@ -17,23 +23,65 @@ class Thermometer {
   const RomCode& rom_code() const { return rom_code_; }
   DeviceFamily family() const { return family_; }
   Resolution resolution() const { return resolution_; }
-  roo_temperature::Temperature temperature() const { return temperature_; }
+
+  // Returns the most recent reading, with calibration applied.
+  roo_temperature::Temperature temperature() const {
+    return RawToTemperature(raw_temperature_);
+  }
+
+  // Returns the most recent reading, with calibration applied, in 1/16 °C, or
+  // kUnknownRawTemperature if unknown.
+  int16_t raw_temperature() const { return raw_temperature_; }
+
+  // Returns the time of the most recent reading. (Readings may be taken at
+  // different times for different thermometers; see
+  // OneWire::updateSelected().)
+  roo_time::Uptime reading_time() const { return reading_time_; }
+
+  // Returns the calibration applied to the readings of this thermometer.
+  const Calibration& calibration() const { return calibration_; }
+
+  // Returns true if the device has the TH and TL registers, backed by EEPROM,
+  // that can be used as general-purpose non-volatile storage.
+  bool hasUserBytes() const {
+    return family_ != DEVICE_FAMILY_MAX31850 &&
+           family_ != DEVICE_FAMILY_UNKNOWN;
+  }
+
+  // Returns the content of the TH (high byte) and TL (low byte) registers.
+  // Meaningful only if hasUserBytes() returns true.
+  uint16_t user_bytes() const { return user_bytes_; }
 
  private:
   friend class Thermometers;
 
+  template <typename... Devices>
+  friend class StaticOneWire;
+
   void set(RomCode rom_code, DeviceFamily family, Resolution resolution,
-           roo_temperature::Temperature temperature) {
+           uint16_t user_bytes, int16_t raw_temperature) {
     rom_code_ = rom_code;
     family_ = family;
     resolution_ = resolution;
-    temperature_ = temperature;
+    user_bytes_ = user_bytes;
+    raw_temperature_ = raw_temperature;
+  }
+
+  void setReadingTime(roo_time::Uptime reading_time) {
+    reading_time_ = reading_time;
+  }
+
+  void setCalibration(const Calibration& calibration) {
+    calibration_ = calibration;
   }
 
   RomCode rom_code_;
   DeviceFamily family_;
   Resolution resolution_;
-  roo_temperature::Temperature temperature_;
+  uint16_t user_bytes_;
+  int16_t raw_temperature_;
+  roo_time::Uptime reading_time_;
+  Calibration calibration_;
 };
 
 roo_logging::Stream& operator<<(roo_logging::Stream& os, const Thermometer& t);
@@ -4,6 +4,7 @@
 
 #include "roo_temperature.h"
 #include "roo_onewire/rom_code.h"
+#include "roo_onewire/thermometers/raw_temperature.h"
 #include "roo_logging.h"
 
 namespace roo_onewire {
@@ -13,7 +14,13 @@ namespace roo_onewire {
 class ThermometerRole : public roo_temperature::Thermometer {
  public:
   ThermometerRole(int id, std::string name)
-      : id_(id), name_(name), rom_code_() {}
+      : id_(id),
+        name_(name),
+        rom_code_(),
+        device_idx_(-1),
+        priority_(0),
+        last_raw_reading_(kUnknownRawTemperature),
+        last_reading_time_(roo_time::Uptime::Start()) {}
 
   int id() const { return id_; }
   const std::string& name() const { return name_; }
@@ -21,8 +28,14 @@ class ThermometerRole : public roo_temperature::Thermometer {
 
   bool isAssigned() const { return !rom_code_.isUnknown(); }
 
+  // See ThermometerRoles::setPriority().
+  int priority() const { return priority_; }
+
   roo_temperature::Thermometer::Reading readTemperature() const override {
-    return last_reading_;
+    roo_temperature::Thermometer::Reading reading;
+    reading.value = RawToTemperature(last_raw_reading_);
+    reading.time = last_reading_time_;
+    return reading;
   }
 
  private:
@@ -30,19 +43,31 @@ class ThermometerRole : public roo_temperature::Thermometer {
 
   void assign(RomCode rom_code) { rom_code_ = rom_code; }
 
-  void unassign() { rom_code_ = RomCode(); }
+  void unassign() {
+    rom_code_ = RomCode();
+    device_idx_ = -1;
+  }
 
-  void setLastReading(roo_temperature::Temperature reading,
-                      roo_time::Uptime time) {
-    last_reading_.value = reading;
-    last_reading_.time = time;
+  void setLastReading(int16_t raw_reading, roo_time::Uptime time) {
+    last_raw_reading_ = raw_reading;
+    last_reading_time_ = time;
   }
 
   int id_;
   std::string name_;
   RomCode rom_code_;
 
-  roo_temperature::Thermometer::Reading last_reading_;
+  // Index of the assigned thermometer in Thermometers, or -1 if the role is
+  // not assigned, or the thermometer is not currently present on the bus.
+  // Re-bound after discovery and (un)assignment.
+  int device_idx_;
+
+  // Read priority, applied to the assigned thermometer.
+  int priority_;
+
+  // Kept in 1/16 °C; converted when read.
+  int16_t last_raw_reading_;
+  roo_time::Uptime last_reading_time_;
 };
 
 roo_logging::Stream& operator<<(roo_logging::Stream& out, const ThermometerRole& role);
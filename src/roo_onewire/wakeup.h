@@ -0,0 +1,34 @@
+#pragma once
+
+#include "roo_time.h"
+
+namespace roo_onewire {
+
+// When the library next needs the CPU, and roughly for how long. Lets
+// tickless and low-power applications sleep until then, instead of polling
+// the scheduler in a tight loop. (Tasks scheduled by the application itself
+// are not covered.)
+struct Wakeup {
+  // No work is scheduled.
+  Wakeup() : time(roo_time::Uptime::Max()), duration() {}
+
+  Wakeup(roo_time::Uptime time, roo_time::Interval duration)
+      : time(time), duration(duration) {}
+
+  // Returns true if there is any work scheduled.
+  bool isScheduled() const { return time != roo_time::Uptime::Max(); }
+
+  // Returns whichever of the two is due first.
+  static Wakeup Earliest(const Wakeup& a, const Wakeup& b) {
+    return (b.time < a.time) ? b : a;
+  }
+
+  // The earliest time at which there is work to do. May be in the past, in
+  // which case the work is due immediately. Uptime::Max() if none.
+  roo_time::Uptime time;
+
+  // Estimated time that the work keeps the CPU (and, usually, the bus) busy.
+  roo_time::Interval duration;
+};
+
+}  // namespace roo_onewire
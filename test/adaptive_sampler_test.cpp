@@ -0,0 +1,98 @@
+#include "roo_onewire/adaptive_sampler.h"
+
+#include <set>
+
+#include "gtest/gtest.h"
+#include "roo_onewire.h"
+#include "roo_onewire/bus_simulation.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+namespace roo_onewire {
+
+namespace {
+
+using roo_time::Seconds;
+using roo_time::Uptime;
+
+static const int kThermometers = 6;
+
+// Returns the number of distinct reading times, i.e. of the conversion
+// groups that the most recent readings came from.
+int ReadingGroups(const Thermometers& thermometers) {
+  std::set<int64_t> reading_times;
+  for (const Thermometer& t : thermometers) {
+    reading_times.insert((t.reading_time() - Uptime::Start()).inMicros());
+  }
+  return reading_times.size();
+}
+
+AdaptiveSampler::Options SamplerOptions() {
+  AdaptiveSampler::Options options;
+  options.min_interval = Seconds(10);
+  options.max_interval = Seconds(60);
+  return options;
+}
+
+// The temperatures are stable, so every thermometer backs off from the
+// minimum interval.
+void ExpectAllBackedOff(const AdaptiveSampler& sampler,
+                        const Thermometers& thermometers) {
+  for (int i = 0; i < thermometers.count(); ++i) {
+    EXPECT_GT(sampler.interval(thermometers.rom_code(i)), Seconds(10))
+        << "thermometer " << i;
+  }
+}
+
+}  // namespace
+
+TEST(AdaptiveSampler, GroupedConversionsPipelined) {
+  TestBus bus(70, kThermometers);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(70, scheduler);
+  BusSimulation simulation;
+  onewire.setBusSimulation(&simulation);
+  Thermometers& t = onewire.thermometers();
+  t.setMaxConcurrentConversions(2);
+  AdaptiveSampler sampler(onewire, scheduler, SamplerOptions());
+  sampler.start();
+  // The first cycle converts three groups, one after another, in about 2.3 s.
+  scheduler.delay(Seconds(5));
+  EXPECT_FALSE(t.isParasite());
+  ASSERT_EQ(kThermometers, t.count());
+  EXPECT_EQ(3, ReadingGroups(t));
+  // Each thermometer has been converted once (with its own Convert T), and
+  // none is due again yet, whichever group it was in.
+  EXPECT_EQ((uint32_t)kThermometers, simulation.conversions());
+  scheduler.delay(Seconds(120));
+  ExpectAllBackedOff(sampler, t);
+  sampler.stop();
+}
+
+TEST(AdaptiveSampler, GroupedConversionsParasite) {
+  TestBus bus(71, kThermometers);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(71, scheduler);
+  BusSimulation::Options options;
+  options.parasite_power = true;
+  BusSimulation simulation(options);
+  onewire.setBusSimulation(&simulation);
+  Thermometers& t = onewire.thermometers();
+  t.setMaxConcurrentConversions(2);
+  AdaptiveSampler sampler(onewire, scheduler, SamplerOptions());
+  sampler.start();
+  // On a parasite-powered bus, the thermometers convert one at a time, in
+  // about 4.5 s.
+  scheduler.delay(Seconds(8));
+  EXPECT_TRUE(t.isParasite());
+  ASSERT_EQ(kThermometers, t.count());
+  EXPECT_EQ(kThermometers, ReadingGroups(t));
+  EXPECT_EQ((uint32_t)kThermometers, simulation.conversions());
+  scheduler.delay(Seconds(120));
+  ExpectAllBackedOff(sampler, t);
+  EXPECT_EQ(0u, simulation.interruptedConversions());
+  sampler.stop();
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,162 @@
+// Verifies that, with ROO_ONEWIRE_MAX_DEVICES set, the steady-state operation
+// does not touch the heap.
+
+#include <stdlib.h>
+
+#include <new>
+
+#include "gtest/gtest.h"
+#include "roo_onewire.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+static_assert(ROO_ONEWIRE_MAX_DEVICES > 0,
+              "Must be built with ROO_ONEWIRE_MAX_DEVICES set");
+
+namespace {
+
+bool g_counting = false;
+int g_allocations = 0;
+
+}  // namespace
+
+void* operator new(size_t size) {
+  if (g_counting) ++g_allocations;
+  void* p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+namespace roo_onewire {
+
+namespace {
+
+using roo_time::Millis;
+using roo_time::Seconds;
+
+// Counts the allocations made while in scope.
+class AllocationCounter {
+ public:
+  AllocationCounter() {
+    g_allocations = 0;
+    g_counting = true;
+  }
+
+  ~AllocationCounter() { g_counting = false; }
+
+  int count() const { return g_allocations; }
+};
+
+class CountingListener : public Thermometers::EventListener {
+ public:
+  CountingListener() : conversions_(0), readings_(0) {}
+
+  void conversionCompleted() const override { ++conversions_; }
+
+  void readingAvailable(const Thermometer& /*thermometer*/) const override {
+    ++readings_;
+  }
+
+  int conversions() const { return conversions_; }
+  int readings() const { return readings_; }
+
+ private:
+  mutable int conversions_;
+  mutable int readings_;
+};
+
+static const int kCycles = 5;
+
+}  // namespace
+
+TEST(Allocation, UpdateWithSynchronousDispatch) {
+  TestBus bus(50, 8);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(50, scheduler);
+  Thermometers& t = onewire.thermometers();
+  CountingListener listener;
+  t.addEventListener(&listener);
+  // Warm up: discover, and learn the conversion time.
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+  }
+  ASSERT_EQ(8, t.count());
+  int allocations;
+  {
+    AllocationCounter counter;
+    for (int i = 0; i < kCycles; ++i) {
+      onewire.update();
+      Wait(scheduler, t);
+    }
+    allocations = counter.count();
+  }
+  EXPECT_EQ(0, allocations);
+  EXPECT_EQ(2 + kCycles, listener.conversions());
+  t.removeEventListener(&listener);
+}
+
+TEST(Allocation, UpdateWithDeferredDispatch) {
+  TestBus bus(51, 8);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(51, scheduler);
+  Thermometers& t = onewire.thermometers();
+  t.setDeferredDispatch(true);
+  CountingListener listener;
+  t.addEventListener(&listener);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+  }
+  // Early readings get queued as well.
+  t.setReadPriority(t.rom_code(0), 1);
+  t.setReadPriority(t.rom_code(1), 1);
+  int allocations;
+  {
+    AllocationCounter counter;
+    for (int i = 0; i < kCycles; ++i) {
+      onewire.update();
+      Wait(scheduler, t);
+    }
+    allocations = counter.count();
+  }
+  EXPECT_EQ(0, allocations);
+  EXPECT_EQ(2 + kCycles, listener.conversions());
+  EXPECT_EQ(2 * kCycles, listener.readings());
+  t.removeEventListener(&listener);
+}
+
+TEST(Allocation, RequestReading) {
+  for (bool deferred : {false, true}) {
+    TestBus bus(52, 8);
+    roo_scheduler::Scheduler scheduler;
+    OneWire onewire(52, scheduler);
+    Thermometers& t = onewire.thermometers();
+    t.setDeferredDispatch(deferred);
+    int calls = 0;
+    for (int i = 0; i < 2; ++i) {
+      scheduler.delay(Seconds(1));
+      onewire.requestReading(Millis(500), [&calls](bool ok) { calls += ok; });
+      Wait(scheduler, t);
+    }
+    int allocations;
+    {
+      AllocationCounter counter;
+      for (int i = 0; i < kCycles; ++i) {
+        // The first one starts the conversion; the second one joins it.
+        scheduler.delay(Seconds(1));
+        onewire.requestReading(Millis(500), [&calls](bool ok) { calls += ok; });
+        onewire.requestReading(Millis(500), [&calls](bool ok) { calls += ok; });
+        Wait(scheduler, t);
+      }
+      allocations = counter.count();
+    }
+    EXPECT_EQ(0, allocations) << "deferred: " << deferred;
+    EXPECT_EQ(2 + 2 * kCycles, calls) << "deferred: " << deferred;
+  }
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,103 @@
+#include "roo_onewire/bus_arbiter.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "roo_testing/buses/onewire/fake_onewire.h"
+#include "roo_testing/devices/microcontroller/esp32/fake_esp32.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// Time for a thread to get blocked in acquire().
+void LetThreadsBlock() {
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+// An arbiter of an empty fake bus.
+class TestArbiter {
+ public:
+  explicit TestArbiter(uint8_t pin) {
+    FakeEsp32().attachOneWireBus(pin, &fake_bus_);
+    bus_.reset(new Bus(FindFakeBus(pin)));
+    arbiter_.reset(new BusArbiter(*bus_));
+  }
+
+  BusArbiter& operator*() { return *arbiter_; }
+  BusArbiter* operator->() { return arbiter_.get(); }
+
+ private:
+  FakeOneWireBus fake_bus_;
+  std::unique_ptr<Bus> bus_;
+  std::unique_ptr<BusArbiter> arbiter_;
+};
+
+}  // namespace
+
+TEST(BusArbiter, HoldOutlivesTransactionAndEndsFromAnyThread) {
+  TestArbiter arbiter(60);
+  {
+    BusArbiter::Transaction transaction(*arbiter);
+    arbiter->holdForConversion();
+  }
+  EXPECT_TRUE(arbiter->isHeldForConversion());
+  EXPECT_TRUE(arbiter->isBusy());
+  EXPECT_FALSE(arbiter->tryAcquire());
+  std::atomic<bool> acquired(false);
+  std::thread waiter([&]() {
+    BusArbiter::Transaction transaction(*arbiter);
+    acquired = true;
+  });
+  LetThreadsBlock();
+  EXPECT_FALSE(acquired);
+  std::thread([&]() { arbiter->endConversionHold(); }).join();
+  waiter.join();
+  EXPECT_TRUE(acquired);
+  EXPECT_FALSE(arbiter->isBusy());
+}
+
+TEST(BusArbiter, HoldStopsReentrantTryAcquire) {
+  TestArbiter arbiter(61);
+  arbiter->acquire();
+  EXPECT_TRUE(arbiter->tryAcquire());
+  arbiter->release();
+  arbiter->holdForConversion();
+  EXPECT_FALSE(arbiter->tryAcquire());
+  arbiter->endConversionHold();
+  EXPECT_TRUE(arbiter->tryAcquire());
+  arbiter->release();
+  arbiter->release();
+  EXPECT_FALSE(arbiter->isBusy());
+}
+
+TEST(BusArbiter, ReentrantAcquireWhileHeldDies) {
+  TestArbiter arbiter(62);
+  EXPECT_DEATH(
+      {
+        arbiter->acquire();
+        arbiter->holdForConversion();
+        arbiter->acquire();
+      },
+      "");
+}
+
+TEST(BusArbiter, TryAcquireYieldsToHigherPriority) {
+  TestArbiter arbiter(63);
+  arbiter->acquire();
+  std::thread waiter([&]() {
+    BusArbiter::Transaction transaction(*arbiter, BusArbiter::PRIORITY_HIGH);
+  });
+  LetThreadsBlock();
+  arbiter->release();
+  // The waiter either still waits, or has taken the bus.
+  EXPECT_FALSE(arbiter->tryAcquire(BusArbiter::PRIORITY_NORMAL));
+  waiter.join();
+  EXPECT_TRUE(arbiter->tryAcquire(BusArbiter::PRIORITY_NORMAL));
+  arbiter->release();
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,272 @@
+#include <memory>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_onewire.h"
+#include "roo_onewire/bus_simulation.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// Time that only moves when advanced.
+class FakeClock : public BusSimulation::Clock {
+ public:
+  FakeClock() : now_(0) {}
+
+  int64_t nowMicros() override { return now_; }
+  void advance(int32_t micros) override { now_ += micros; }
+
+ private:
+  int64_t now_;
+};
+
+BusSimulation::Options WithClock(FakeClock& clock, Resolution resolution) {
+  BusSimulation::Options options;
+  options.resolution = resolution;
+  options.clock = &clock;
+  return options;
+}
+
+}  // namespace
+
+TEST(BusSimulation, ElapseAdvancesClock) {
+  FakeClock clock;
+  BusSimulation simulation(WithClock(clock, RESOLUTION_12_BITS));
+  simulation.elapse(BusTiming::kResetMicros);
+  simulation.elapse(8 * BusTiming::kSlotMicros);
+  EXPECT_EQ(BusTiming::kResetMicros + 8 * BusTiming::kSlotMicros,
+            clock.nowMicros());
+  EXPECT_EQ(clock.nowMicros(), simulation.elapsedMicros());
+}
+
+TEST(BusSimulation, ConversionTimeFollowsResolution) {
+  FakeClock clock;
+  EXPECT_EQ(93750, BusSimulation(WithClock(clock, RESOLUTION_9_BITS))
+                       .conversionMicros());
+  EXPECT_EQ(187500, BusSimulation(WithClock(clock, RESOLUTION_10_BITS))
+                        .conversionMicros());
+  EXPECT_EQ(375000, BusSimulation(WithClock(clock, RESOLUTION_11_BITS))
+                        .conversionMicros());
+  EXPECT_EQ(750000, BusSimulation(WithClock(clock, RESOLUTION_12_BITS))
+                        .conversionMicros());
+}
+
+TEST(BusSimulation, ConvertsForTheConversionTime) {
+  FakeClock clock;
+  BusSimulation simulation(WithClock(clock, RESOLUTION_10_BITS));
+  EXPECT_FALSE(simulation.isConverting());
+  simulation.startConversion();
+  EXPECT_TRUE(simulation.isConverting());
+  clock.advance(187499);
+  EXPECT_TRUE(simulation.isConverting());
+  clock.advance(1);
+  EXPECT_FALSE(simulation.isConverting());
+  EXPECT_EQ(1u, simulation.conversions());
+}
+
+TEST(BusSimulation, AccountsPullUpHold) {
+  FakeClock clock;
+  BusSimulation simulation(WithClock(clock, RESOLUTION_9_BITS));
+  simulation.startConversion();
+  simulation.beginPullUp();
+  clock.advance(100000);
+  simulation.endPullUp();
+  // Not held anymore.
+  clock.advance(50000);
+  simulation.endPullUp();
+  EXPECT_EQ(100000, simulation.pullUpMicros());
+  EXPECT_EQ(0u, simulation.interruptedConversions());
+}
+
+TEST(BusSimulation, EarlyPullUpReleaseInterruptsConversion) {
+  FakeClock clock;
+  BusSimulation simulation(WithClock(clock, RESOLUTION_12_BITS));
+  simulation.startConversion();
+  simulation.beginPullUp();
+  clock.advance(500000);
+  simulation.endPullUp();
+  EXPECT_EQ(500000, simulation.pullUpMicros());
+  // Not powered for longer than a time slot.
+  clock.advance(BusTiming::kSlotMicros + 1);
+  // The device browned out; it is not converting anymore.
+  EXPECT_FALSE(simulation.isConverting());
+  EXPECT_EQ(1u, simulation.interruptedConversions());
+}
+
+TEST(BusSimulation, PollSlotBridgedByPullUp) {
+  FakeClock clock;
+  BusSimulation simulation(WithClock(clock, RESOLUTION_12_BITS));
+  simulation.startConversion();
+  simulation.beginPullUp();
+  clock.advance(500000);
+  // A poll, with the pull-up turned back on right after it.
+  simulation.endPullUp();
+  clock.advance(BusTiming::kSlotMicros);
+  simulation.beginPullUp();
+  EXPECT_TRUE(simulation.isConverting());
+  clock.advance(250000);
+  simulation.endPullUp();
+  EXPECT_FALSE(simulation.isConverting());
+  EXPECT_EQ(0u, simulation.interruptedConversions());
+}
+
+namespace {
+
+static const int kBusCount = 4;
+static const int kThermometersPerBus = 25;
+
+// The capacity target: every thermometer sampled every 3 seconds. The buses
+// share the CPU, so their bus operations run one after another: about 0.4 s
+// of discovery, and 25 scratchpad reads of about 12.5 ms, per bus. Only the
+// 750 ms conversions (at 12 bits) overlap, with each other, and with the
+// discovery on the other buses. A cycle takes about 2.8 s.
+static const int64_t kSamplingPeriodMicros = 3000000;
+
+// The uptime clock, which the scheduler reads, advanced by roo_time::Delay()
+// (which, under roo_testing, advances the emulated time).
+class UptimeClock : public BusSimulation::Clock {
+ public:
+  int64_t nowMicros() override {
+    return (roo_time::Uptime::Now() - roo_time::Uptime::Start()).inMicros();
+  }
+
+  void advance(int32_t micros) override {
+    roo_time::Delay(roo_time::Micros(micros));
+  }
+};
+
+// A fake bus of DS18B20 thermometers, attached to a pin of the fake ESP32,
+// with a simulated 30 m cable.
+class SimulatedBus {
+ public:
+  SimulatedBus(int index, BusSimulation::Clock& clock,
+               roo_scheduler::Scheduler& scheduler)
+      : simulation_([&clock]() {
+          BusSimulation::Options options;
+          options.cable_length_m = 30;
+          options.clock = &clock;
+          return options;
+        }()),
+        bus_(20 + index) {
+    for (int i = 0; i < kThermometersPerBus; ++i) {
+      bus_.add(MakeRomCode(0x28, index * 1000 + i + 1),
+               20.0f + index + 0.0625f * i);
+    }
+    onewire_.reset(new OneWire(20 + index, scheduler));
+    onewire_->setBusSimulation(&simulation_);
+    onewire_->thermometers().setOverlapDiscoveryWithConversion(true);
+  }
+
+  OneWire& onewire() { return *onewire_; }
+  const BusSimulation& simulation() const { return simulation_; }
+
+ private:
+  BusSimulation simulation_;
+  TestBus bus_;
+  std::unique_ptr<OneWire> onewire_;
+};
+
+}  // namespace
+
+// 100 thermometers, spread over 4 buses, sampled at 12 bits. All buses share
+// one clock, which the bus operations and the scheduler's waits both advance,
+// so the measured cycle is the wall time of the whole installation: the bus
+// operations of the buses add up, and only the conversions run concurrently.
+TEST(BusSimulation, CapacityOf100ThermometersOn4Buses) {
+  UptimeClock clock;
+  roo_scheduler::Scheduler scheduler;
+  std::vector<std::unique_ptr<SimulatedBus>> buses;
+  for (int i = 0; i < kBusCount; ++i) {
+    buses.emplace_back(new SimulatedBus(i, clock, scheduler));
+  }
+  // The first cycle also reads the scratchpads of the newly discovered
+  // thermometers; only the steady state is measured.
+  for (int cycle = 0; cycle < 4; ++cycle) {
+    int64_t start = clock.nowMicros();
+    for (auto& bus : buses) {
+      ASSERT_TRUE(bus->onewire().update());
+    }
+    for (auto& bus : buses) {
+      Wait(scheduler, bus->onewire().thermometers());
+    }
+    int64_t cycle_micros = clock.nowMicros() - start;
+    if (cycle > 0) {
+      EXPECT_LT(cycle_micros, kSamplingPeriodMicros) << "cycle " << cycle;
+      // Not much faster, either; the bus operations do add up.
+      EXPECT_GT(cycle_micros, kSamplingPeriodMicros * 3 / 4)
+          << "cycle " << cycle;
+    }
+    for (int i = 0; i < kBusCount; ++i) {
+      const Thermometers& thermometers = buses[i]->onewire().thermometers();
+      ASSERT_EQ(kThermometersPerBus, thermometers.count());
+      for (int j = 0; j < thermometers.count(); ++j) {
+        EXPECT_NE(kUnknownRawTemperature,
+                  thermometers.thermometer(j).raw_temperature());
+      }
+    }
+  }
+  for (int i = 0; i < kBusCount; ++i) {
+    const BusSimulation& simulation = buses[i]->simulation();
+    // Externally powered; no strong pull-up.
+    EXPECT_EQ(0, simulation.pullUpMicros());
+    EXPECT_EQ(0u, simulation.interruptedConversions());
+    EXPECT_EQ(4u, simulation.conversions());
+  }
+}
+
+// On a parasite-powered bus, the learned conversion time converges to the
+// actual one plus the safety margin; the strong pull-up, released for the
+// polls, gets turned back on after each of them.
+TEST(BusSimulation, LearnsParasiteConversionTime) {
+  UptimeClock clock;
+  TestBus bus(30, 2);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(30, scheduler);
+  BusSimulation::Options options;
+  options.resolution = RESOLUTION_10_BITS;
+  options.parasite_power = true;
+  options.clock = &clock;
+  BusSimulation simulation(options);
+  onewire.setBusSimulation(&simulation);
+  Thermometers& t = onewire.thermometers();
+  t.setConversionTimeLearning(true);
+  // Discover, and measure.
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+  }
+  ASSERT_TRUE(t.isParasite());
+  // 187.5 ms, plus 25%, plus the 10 ms polling granularity; measured no
+  // later than a poll after the conversion completed.
+  EXPECT_GE(t.learnedConversionTime(), roo_time::Micros(244375));
+  EXPECT_LT(t.learnedConversionTime(), roo_time::Micros(257500));
+  // Subsequent conversions wait for the learned time (plus the reads), well
+  // under the default.
+  int64_t start = clock.nowMicros();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_LT(clock.nowMicros() - start, 400000);
+  EXPECT_EQ(0u, simulation.interruptedConversions());
+  EXPECT_EQ(3u, simulation.conversions());
+
+  // The thermometers get switched to 12 bits, behind our back: the learned
+  // time turns out too short, and the default of 750 ms applies.
+  options.resolution = RESOLUTION_12_BITS;
+  BusSimulation slower(options);
+  onewire.setBusSimulation(&slower);
+  start = clock.nowMicros();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(roo_time::Micros(0), t.learnedConversionTime());
+  EXPECT_GE(clock.nowMicros() - start, 750000);
+  EXPECT_EQ(0u, slower.interruptedConversions());
+  for (const Thermometer& thermometer : t) {
+    EXPECT_NE(kUnknownRawTemperature, thermometer.raw_temperature());
+  }
+}
+
+}  // namespace roo_onewire
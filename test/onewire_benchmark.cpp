@@ -0,0 +1,191 @@
+// Benchmarks discovery, conversion and reading on fake buses populated with
+// 1, 8, 64 and 256 thermometers of mixed families (DS18S20, DS1822, DS18B20,
+// DS1825 and DS28EA00). Discovery is measured on its own (see
+// OneWire::discoveryStats() and OneWire::discoveryTime()), separately from
+// the rest of update(), and from reading the results after the conversion.
+// Then, binds a role to every thermometer, and measures looking up their
+// temperatures, by ID and in a batch.
+//
+// Prints CSV, in the same format as the benchmark example, with one line per
+// bus size and measured phase. With --simulate, attaches a timing and
+// reliability model (see BusSimulation) of a 50 m cable.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <map>
+#include <vector>
+
+#include "roo_onewire.h"
+#include "roo_onewire/thermometer_roles.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+namespace roo_onewire {
+
+namespace {
+
+using roo_time::Interval;
+using roo_time::Uptime;
+
+static const int kBusSizes[] = {1, 8, 64, 256};
+
+static const uint8_t kFamilies[] = {0x10, 0x22, 0x28, 0x3B, 0x42};
+
+// Number of warm cycles (with nothing new discovered) per bus size.
+static const int kIterations = 10;
+
+// Number of passes over all roles, per measured lookup phase.
+static const int kLookupIterations = 100;
+
+// Returns a valid rom code, with the CRC, of the ith device.
+uint64_t DeviceRomCode(int i) {
+  // Spread the serial numbers, so that the search tree is not degenerate.
+  return MakeRomCode(kFamilies[i % sizeof(kFamilies)],
+                     (uint64_t)(i * 0x9E3779B1u));
+}
+
+// Populates the bus with the specified number of devices.
+void Populate(TestBus& bus, int count) {
+  for (int i = 0; i < count; ++i) {
+    bus.add(DeviceRomCode(i), 20.0f + 0.0625f * i);
+  }
+}
+
+void PrintHeader() {
+  printf(
+      "phase,devices,iterations,wall_us,resets,presence_failures,searches,"
+      "slots,bytes_written,bytes_read,overdrive_slots,bus_time_us\n");
+}
+
+void Print(const char* phase, int devices, int iterations, Interval elapsed,
+           const BusStats& stats) {
+  printf("%s,%d,%d,%lld,%u,%u,%u,%u,%u,%u,%u,%lld\n", phase, devices,
+         iterations, (long long)elapsed.inMicros(), stats.resets,
+         stats.presence_failures, stats.searches, stats.slots,
+         stats.bytes_written, stats.bytes_read, stats.overdrive_slots,
+         (long long)stats.bus_time_micros);
+}
+
+// Runs a complete cycle, reporting discovery, the rest of update(), and
+// reading the results, separately.
+void Cycle(roo_scheduler::Scheduler& scheduler, OneWire& onewire, int devices,
+           const char* suffix) {
+  char phase[32];
+  onewire.resetBusStats();
+  Uptime start = Uptime::Now();
+  onewire.update();
+  Interval elapsed = Uptime::Now() - start;
+  BusStats discovery = onewire.discoveryStats();
+  Interval discovery_time = onewire.discoveryTime();
+  snprintf(phase, sizeof(phase), "discovery_%s", suffix);
+  Print(phase, devices, 1, discovery_time, discovery);
+  snprintf(phase, sizeof(phase), "update_%s", suffix);
+  Print(phase, devices, 1,
+        roo_time::Micros(elapsed.inMicros() - discovery_time.inMicros()),
+        onewire.busStats() - discovery);
+
+  onewire.resetBusStats();
+  scheduler.delayUntil(onewire.thermometers().getPendingConversionTime());
+  start = Uptime::Now();
+  while (onewire.thermometers().isConversionPending()) {
+    scheduler.executeEligibleTasksUpToNow();
+  }
+  snprintf(phase, sizeof(phase), "read_%s", suffix);
+  Print(phase, devices, 1, Uptime::Now() - start, onewire.busStats());
+}
+
+// Keeps the role assignments in memory.
+class MemoryStore : public ThermometerRoleStore {
+ public:
+  RomCode getRomCode(int id) override {
+    auto itr = rom_codes_.find(id);
+    return itr == rom_codes_.end() ? RomCode() : itr->second;
+  }
+
+  void setRomCode(int id, RomCode rom_code) override {
+    rom_codes_[id] = rom_code;
+  }
+
+  void clearRomCode(int id) override { rom_codes_.erase(id); }
+
+ private:
+  std::map<int, RomCode> rom_codes_;
+};
+
+Interval Since(std::chrono::steady_clock::time_point start) {
+  return roo_time::Micros(std::chrono::duration_cast<std::chrono::microseconds>(
+                              std::chrono::steady_clock::now() - start)
+                              .count());
+}
+
+// Binds a role to every thermometer, and reports looking up the temperatures
+// of all roles, one by one with temperatureById(), and in a single batch with
+// temperaturesByIndexes(). The lookups do not touch the bus, so they are
+// timed by the host clock.
+void Lookups(OneWire& onewire) {
+  const Thermometers& t = onewire.thermometers();
+  int count = t.count();
+  if (count == 0) return;
+  std::vector<ThermometerRoles::Spec> specs;
+  for (int i = 0; i < count; ++i) {
+    specs.push_back(ThermometerRoles::Spec{i + 1, "role"});
+  }
+  MemoryStore store;
+  ThermometerRoles roles(onewire, store, specs);
+  std::vector<int> indexes;
+  for (int i = 0; i < count; ++i) {
+    roles.assign(i + 1, t.rom_code(i));
+    indexes.push_back(roles.roleIndexById(i + 1));
+  }
+  // Accumulated, so that the lookups are not optimized away.
+  float sum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < kLookupIterations; ++n) {
+    for (int i = 0; i < count; ++i) {
+      sum += roles.temperatureById(i + 1).degCelcius();
+    }
+  }
+  Print("lookup_by_id", count, kLookupIterations, Since(start), BusStats());
+  std::vector<roo_temperature::Temperature> out(count);
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < kLookupIterations; ++n) {
+    roles.temperaturesByIndexes(&indexes[0], &out[0], count);
+    sum += out[n % count].degCelcius();
+  }
+  Print("lookup_batch", count, kLookupIterations, Since(start), BusStats());
+  if (sum == 0) printf("# all zero\n");
+}
+
+void Run(bool simulate) {
+  BusSimulation::Options options;
+  options.cable_length_m = 50;
+  BusSimulation simulation(options);
+  roo_scheduler::Scheduler scheduler;
+  PrintHeader();
+  uint8_t pin = 10;
+  for (int devices : kBusSizes) {
+    TestBus bus(pin);
+    Populate(bus, devices);
+    OneWire onewire(pin, scheduler);
+    ++pin;
+    if (simulate) onewire.setBusSimulation(&simulation);
+    // The first cycle discovers all devices, and reads their scratchpads.
+    Cycle(scheduler, onewire, devices, "cold");
+    for (int i = 0; i < kIterations; ++i) {
+      Cycle(scheduler, onewire, devices, "warm");
+    }
+    Lookups(onewire);
+  }
+}
+
+}  // namespace
+
+}  // namespace roo_onewire
+
+int main(int argc, char** argv) {
+  roo_onewire::Run(argc > 1 && strcmp(argv[1], "--simulate") == 0);
+  return 0;
+}
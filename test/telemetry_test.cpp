@@ -0,0 +1,195 @@
+#include "roo_onewire/telemetry.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_onewire.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+namespace roo_onewire {
+
+namespace {
+
+using roo_time::Millis;
+using roo_time::Uptime;
+
+static const size_t kCapacity = 1024;
+
+// Writes a snapshot, and returns it (empty if it did not fit).
+std::vector<uint8_t> Write(TelemetrySerializer& serializer,
+                           TelemetrySerializer::Format format, bool delta,
+                           size_t capacity = kCapacity) {
+  std::vector<uint8_t> buf(capacity);
+  buf.resize(serializer.write(buf.data(), capacity, format, delta));
+  return buf;
+}
+
+std::vector<uint8_t> WriteBinary(TelemetrySerializer& serializer, bool delta) {
+  return Write(serializer, TelemetrySerializer::FORMAT_BINARY, delta);
+}
+
+std::string WriteJson(TelemetrySerializer& serializer) {
+  std::vector<uint8_t> json =
+      Write(serializer, TelemetrySerializer::FORMAT_JSON, false);
+  return std::string(json.begin(), json.end());
+}
+
+// Runs a conversion cycle.
+void Update(OneWire& onewire, roo_scheduler::Scheduler& scheduler) {
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, onewire.thermometers());
+}
+
+}  // namespace
+
+TEST(Telemetry, BinaryRoundTrip) {
+  TestBus bus(80, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(80, scheduler);
+  Update(onewire, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  ASSERT_EQ(3, t.count());
+  scheduler.delay(Millis(120));
+  TelemetrySerializer serializer(t);
+  std::vector<uint8_t> snapshot = WriteBinary(serializer, false);
+  ASSERT_FALSE(snapshot.empty());
+  TelemetryDecoder decoder;
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  EXPECT_FALSE(decoder.delta());
+  EXPECT_EQ(Uptime::Now().inMillis(), decoder.time_ms());
+  ASSERT_EQ(3u, decoder.records().size());
+  for (int i = 0; i < 3; ++i) {
+    const TelemetryDecoder::Record& r = decoder.records()[i];
+    EXPECT_EQ(t.rom_code(i), r.rom_code) << i;
+    EXPECT_EQ(t.thermometer(i).raw_temperature(), r.raw_temperature) << i;
+    EXPECT_EQ(120, r.age_ms) << i;
+    EXPECT_EQ(-1, r.role_id) << i;
+  }
+  // Truncated data does not decode.
+  TelemetryDecoder truncated;
+  EXPECT_FALSE(truncated.decode(snapshot.data(), snapshot.size() - 1));
+}
+
+TEST(Telemetry, DeltaAfterReadingChanged) {
+  TestBus bus(81, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(81, scheduler);
+  Update(onewire, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  TelemetrySerializer serializer(t);
+  TelemetryDecoder decoder;
+  std::vector<uint8_t> snapshot = WriteBinary(serializer, true);
+  // The first snapshot is complete, even if a delta is requested.
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  EXPECT_FALSE(decoder.delta());
+  ASSERT_EQ(3u, decoder.records().size());
+
+  bus.thermometer(1).set(25.0f);
+  Update(onewire, scheduler);
+  snapshot = WriteBinary(serializer, true);
+  // Only the changed reading is sent; the re-read ones are not.
+  TelemetryDecoder alone;
+  ASSERT_TRUE(alone.decode(snapshot.data(), snapshot.size()));
+  EXPECT_TRUE(alone.delta());
+  ASSERT_EQ(1u, alone.records().size());
+  EXPECT_EQ(25 * 16, alone.records()[0].raw_temperature);
+  // Applied to the previous state.
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  EXPECT_TRUE(decoder.delta());
+  ASSERT_EQ(3u, decoder.records().size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(t.rom_code(i), decoder.records()[i].rom_code) << i;
+    EXPECT_EQ(t.thermometer(i).raw_temperature(),
+              decoder.records()[i].raw_temperature)
+        << i;
+  }
+
+  // Nothing changed since.
+  Update(onewire, scheduler);
+  snapshot = WriteBinary(serializer, true);
+  alone.clear();
+  ASSERT_TRUE(alone.decode(snapshot.data(), snapshot.size()));
+  EXPECT_TRUE(alone.records().empty());
+}
+
+TEST(Telemetry, DeltaAfterDeviceRemoved) {
+  TestBus bus(82, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(82, scheduler);
+  Update(onewire, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  TelemetrySerializer serializer(t);
+  TelemetryDecoder decoder;
+  std::vector<uint8_t> snapshot = WriteBinary(serializer, false);
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  ASSERT_EQ(3u, decoder.records().size());
+
+  RomCode removed(MakeRomCode(0x28, 82 * 100 + 2));
+  bus.remove(1);
+  Update(onewire, scheduler);
+  ASSERT_EQ(2, t.count());
+  snapshot = WriteBinary(serializer, true);
+  TelemetryDecoder alone;
+  ASSERT_TRUE(alone.decode(snapshot.data(), snapshot.size()));
+  EXPECT_TRUE(alone.records().empty());
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  ASSERT_EQ(2u, decoder.records().size());
+  for (const TelemetryDecoder::Record& r : decoder.records()) {
+    EXPECT_FALSE(r.rom_code == removed);
+  }
+}
+
+TEST(Telemetry, TooSmallBufferKeepsBaseline) {
+  TestBus bus(83, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(83, scheduler);
+  Update(onewire, scheduler);
+  TelemetrySerializer serializer(onewire.thermometers());
+  // Does not fit; the next snapshot is still complete.
+  EXPECT_TRUE(
+      Write(serializer, TelemetrySerializer::FORMAT_BINARY, true, 16).empty());
+  std::vector<uint8_t> snapshot = WriteBinary(serializer, true);
+  TelemetryDecoder decoder;
+  ASSERT_TRUE(decoder.decode(snapshot.data(), snapshot.size()));
+  EXPECT_FALSE(decoder.delta());
+  EXPECT_EQ(3u, decoder.records().size());
+
+  // Same for a delta: the change is not lost.
+  bus.thermometer(0).set(30.0f);
+  Update(onewire, scheduler);
+  EXPECT_TRUE(
+      Write(serializer, TelemetrySerializer::FORMAT_BINARY, true, 16).empty());
+  EXPECT_TRUE(
+      Write(serializer, TelemetrySerializer::FORMAT_JSON, true, 16).empty());
+  snapshot = WriteBinary(serializer, true);
+  TelemetryDecoder alone;
+  ASSERT_TRUE(alone.decode(snapshot.data(), snapshot.size()));
+  EXPECT_TRUE(alone.delta());
+  ASSERT_EQ(1u, alone.records().size());
+  EXPECT_EQ(30 * 16, alone.records()[0].raw_temperature);
+}
+
+TEST(Telemetry, JsonTemperatures) {
+  TestBus bus(84);
+  bus.add(MakeRomCode(0x28, 1), -0.5f);
+  bus.add(MakeRomCode(0x28, 2), -10.125f);
+  bus.add(MakeRomCode(0x28, 3), 21.5625f);
+  bus.add(MakeRomCode(0x28, 4), 0.0f);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(84, scheduler);
+  Update(onewire, scheduler);
+  ASSERT_EQ(4, onewire.thermometers().count());
+  TelemetrySerializer serializer(onewire.thermometers());
+  std::string json = WriteJson(serializer);
+  EXPECT_EQ(0u, json.find("{\"v\":1,\"delta\":false,\"t\":")) << json;
+  EXPECT_NE(std::string::npos, json.find("\"temp\":-0.5,")) << json;
+  EXPECT_NE(std::string::npos, json.find("\"temp\":-10.125,")) << json;
+  EXPECT_NE(std::string::npos, json.find("\"temp\":21.5625,")) << json;
+  EXPECT_NE(std::string::npos, json.find("\"temp\":0,")) << json;
+  EXPECT_NE(std::string::npos, json.find("],\"removed\":[]}")) << json;
+}
+
+}  // namespace roo_onewire
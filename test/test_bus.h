@@ -0,0 +1,77 @@
+#pragma once
+
+// Fake buses of thermometers, shared by the tests and the benchmark.
+
+#include <memory>
+#include <vector>
+
+#include "roo_onewire.h"
+#include "roo_onewire/crc8.h"
+#include "roo_scheduler.h"
+#include "roo_testing/buses/onewire/fake_onewire.h"
+#include "roo_testing/devices/microcontroller/esp32/fake_esp32.h"
+#include "roo_testing/devices/onewire/thermometer/thermometer.h"
+
+namespace roo_onewire {
+
+// Returns a valid rom code (with the CRC) of the specified family, and with
+// the specified (48-bit) serial number.
+inline uint64_t MakeRomCode(uint8_t family, uint64_t serial) {
+  uint64_t rom_code = family | ((serial & 0xFFFFFFFFFFFFull) << 8);
+  return rom_code | ((uint64_t)RomCodeCrc8Bitwise(rom_code) << 56);
+}
+
+// A fake bus of thermometers, attached to a pin of the fake ESP32.
+class TestBus {
+ public:
+  // Creates an empty bus.
+  explicit TestBus(uint8_t pin) { FakeEsp32().attachOneWireBus(pin, &bus_); }
+
+  // Creates a bus with the specified number of thermometers of the specified
+  // family, reading 20 °C, 21 °C, and so on.
+  TestBus(uint8_t pin, int count, uint8_t family = 0x28) : TestBus(pin) {
+    for (int i = 0; i < count; ++i) {
+      add(MakeRomCode(family, pin * 100 + i + 1), 20.0f + i);
+    }
+  }
+
+  // Adds a thermometer with the specified rom code, reading the specified
+  // temperature.
+  FakeOneWireThermometer& add(uint64_t rom_code, float temperature) {
+    char str[17];
+    RomCode(rom_code).toCharArray(str);
+    str[16] = 0;
+    thermometers_.emplace_back(new FakeOneWireThermometer(str));
+    thermometers_.back()->set(temperature);
+    bus_.addDevice(*thermometers_.back());
+    return *thermometers_.back();
+  }
+
+  // Disconnects the thermometer at the specified index.
+  void remove(int idx) {
+    bus_.removeDevice(*thermometers_[idx]);
+    thermometers_.erase(thermometers_.begin() + idx);
+  }
+
+  int count() const { return thermometers_.size(); }
+
+  FakeOneWireThermometer& thermometer(int idx) { return *thermometers_[idx]; }
+
+ private:
+  FakeOneWireBus bus_;
+  std::vector<std::unique_ptr<FakeOneWireThermometer>> thermometers_;
+};
+
+// Runs the scheduler until no conversion is pending, and all events have been
+// delivered.
+inline void Wait(roo_scheduler::Scheduler& scheduler, const Thermometers& t) {
+  while (t.isConversionPending()) {
+    scheduler.delayUntil(t.getPendingConversionTime());
+    scheduler.executeEligibleTasksUpToNow();
+  }
+  while (t.hasPendingEvents()) {
+    scheduler.executeEligibleTasksUpToNow();
+  }
+}
+
+}  // namespace roo_onewire
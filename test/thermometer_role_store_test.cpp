@@ -0,0 +1,216 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_onewire/thermometers/hal/coalescing_thermometer_role_store.h"
+#include "roo_onewire/thermometers/hal/file/thermometer_role_store_file.h"
+#include "roo_scheduler.h"
+
+namespace roo_onewire {
+
+namespace {
+
+// Enough to matter for stores that write role by role.
+static const int kRoleCount = 500;
+
+std::string TempPath(const char* name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  std::string path = std::string(dir == nullptr ? "/tmp" : dir) + "/" + name;
+  remove(path.c_str());
+  return path;
+}
+
+// Sparse, non-consecutive IDs, with every 7th role left unassigned.
+void MakeBindings(std::vector<int>& ids, std::vector<RomCode>& rom_codes) {
+  ids.clear();
+  rom_codes.clear();
+  for (int i = 0; i < kRoleCount; ++i) {
+    ids.push_back(i * 3 + 1);
+    rom_codes.push_back(i % 7 == 0 ? RomCode()
+                                   : RomCode(0x1234560000000028LL + (i << 8)));
+  }
+}
+
+void ExpectBindings(ThermometerRoleStore& store, const std::vector<int>& ids,
+                    const std::vector<RomCode>& expected) {
+  std::vector<RomCode> actual(ids.size());
+  store.getRomCodes(&ids[0], &actual[0], ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(expected[i].raw(), actual[i].raw()) << "id " << ids[i];
+  }
+}
+
+// Forwards to another store, counting the writes.
+class CountingStore : public ThermometerRoleStore {
+ public:
+  CountingStore(ThermometerRoleStore& delegate)
+      : delegate_(delegate), reads_(0), writes_(0) {}
+
+  RomCode getRomCode(int id) override {
+    ++reads_;
+    return delegate_.getRomCode(id);
+  }
+
+  void setRomCode(int id, RomCode rom_code) override {
+    ++writes_;
+    delegate_.setRomCode(id, rom_code);
+  }
+
+  void clearRomCode(int id) override {
+    ++writes_;
+    delegate_.clearRomCode(id);
+  }
+
+  void getRomCodes(const int* ids, RomCode* rom_codes, int count) override {
+    ++reads_;
+    delegate_.getRomCodes(ids, rom_codes, count);
+  }
+
+  void setRomCodes(const int* ids, const RomCode* rom_codes,
+                   int count) override {
+    ++writes_;
+    delegate_.setRomCodes(ids, rom_codes, count);
+  }
+
+  int reads() const { return reads_; }
+  int writes() const { return writes_; }
+
+ private:
+  ThermometerRoleStore& delegate_;
+  int reads_;
+  int writes_;
+};
+
+class DeviceStore : public ThermometerRoleStore {
+ public:
+  RomCode getRomCode(int id) override { return RomCode(); }
+  void setRomCode(int id, RomCode rom_code) override {}
+  void clearRomCode(int id) override {}
+  bool isStoredOnDevices() const override { return true; }
+};
+
+}  // namespace
+
+TEST(FileThermometerRoleStore, BulkRoundTrip) {
+  std::string path = TempPath("roles_bulk");
+  std::vector<int> ids;
+  std::vector<RomCode> rom_codes;
+  MakeBindings(ids, rom_codes);
+  {
+    FileThermometerRoleStore store(path);
+    store.setRomCodes(&ids[0], &rom_codes[0], ids.size());
+    ExpectBindings(store, ids, rom_codes);
+  }
+  FileThermometerRoleStore reloaded(path);
+  ExpectBindings(reloaded, ids, rom_codes);
+  EXPECT_TRUE(reloaded.getRomCode(0).isUnknown());
+  EXPECT_TRUE(reloaded.getRomCode(kRoleCount * 3 + 1).isUnknown());
+}
+
+TEST(FileThermometerRoleStore, IndividualUpdates) {
+  std::string path = TempPath("roles_individual");
+  std::vector<int> ids;
+  std::vector<RomCode> rom_codes;
+  MakeBindings(ids, rom_codes);
+  {
+    FileThermometerRoleStore store(path);
+    // In reverse, to exercise the sorted insertion.
+    for (int i = kRoleCount - 1; i >= 0; --i) {
+      if (!rom_codes[i].isUnknown()) store.setRomCode(ids[i], rom_codes[i]);
+    }
+    for (int i = 0; i < kRoleCount; i += 5) {
+      store.clearRomCode(ids[i]);
+      rom_codes[i] = RomCode();
+    }
+  }
+  FileThermometerRoleStore reloaded(path);
+  ExpectBindings(reloaded, ids, rom_codes);
+}
+
+TEST(FileThermometerRoleStore, CorruptCountIgnored) {
+  std::string path = TempPath("roles_corrupt");
+  {
+    FileThermometerRoleStore store(path);
+    store.setRomCode(1, RomCode(0x1234560000000128LL));
+    store.setRomCode(2, RomCode(0x1234560000000228LL));
+  }
+  // Claims 2^32 - 1 records, in place of 2.
+  FILE* f = fopen(path.c_str(), "r+b");
+  ASSERT_NE(nullptr, f);
+  const uint8_t count[] = {0xFF, 0xFF, 0xFF, 0xFF};
+  ASSERT_EQ(0, fseek(f, 4, SEEK_SET));
+  ASSERT_EQ(4u, fwrite(count, 1, 4, f));
+  fclose(f);
+  FileThermometerRoleStore reloaded(path);
+  EXPECT_TRUE(reloaded.getRomCode(1).isUnknown());
+  EXPECT_TRUE(reloaded.getRomCode(2).isUnknown());
+}
+
+TEST(CoalescingThermometerRoleStore, CoalescesWrites) {
+  std::string path = TempPath("roles_coalesced");
+  std::vector<int> ids;
+  std::vector<RomCode> rom_codes;
+  MakeBindings(ids, rom_codes);
+  roo_scheduler::Scheduler scheduler;
+  FileThermometerRoleStore file(path);
+  CountingStore counting(file);
+  {
+    CoalescingThermometerRoleStore store(counting, scheduler);
+    for (int i = 0; i < kRoleCount; ++i) {
+      if (rom_codes[i].isUnknown()) {
+        store.clearRomCode(ids[i]);
+      } else {
+        store.setRomCode(ids[i], rom_codes[i]);
+      }
+    }
+    // Served from the cache.
+    ExpectBindings(store, ids, rom_codes);
+    EXPECT_TRUE(store.hasPendingChanges());
+    EXPECT_EQ(0, counting.writes());
+    store.commit();
+    EXPECT_FALSE(store.hasPendingChanges());
+    EXPECT_EQ(1, counting.writes());
+
+    // Re-assigning the same values does not write anything.
+    store.setRomCodes(&ids[0], &rom_codes[0], ids.size());
+    EXPECT_FALSE(store.hasPendingChanges());
+
+    // Changes pending at destruction get written.
+    store.setRomCode(ids[1], RomCode(0x42));
+    rom_codes[1] = RomCode(0x42);
+  }
+  EXPECT_EQ(2, counting.writes());
+  FileThermometerRoleStore reloaded(path);
+  ExpectBindings(reloaded, ids, rom_codes);
+}
+
+TEST(CoalescingThermometerRoleStore, LoadsInBulk) {
+  std::string path = TempPath("roles_preloaded");
+  std::vector<int> ids;
+  std::vector<RomCode> rom_codes;
+  MakeBindings(ids, rom_codes);
+  {
+    FileThermometerRoleStore file(path);
+    file.setRomCodes(&ids[0], &rom_codes[0], ids.size());
+  }
+  roo_scheduler::Scheduler scheduler;
+  FileThermometerRoleStore file(path);
+  CountingStore counting(file);
+  CoalescingThermometerRoleStore store(counting, scheduler);
+  ExpectBindings(store, ids, rom_codes);
+  EXPECT_EQ(1, counting.reads());
+  // Cached now.
+  ExpectBindings(store, ids, rom_codes);
+  EXPECT_EQ(1, counting.reads());
+  EXPECT_FALSE(store.hasPendingChanges());
+}
+
+TEST(CoalescingThermometerRoleStoreDeathTest, RejectsDeviceStore) {
+  roo_scheduler::Scheduler scheduler;
+  DeviceStore devices;
+  EXPECT_DEATH(CoalescingThermometerRoleStore(devices, scheduler), "");
+}
+
+}  // namespace roo_onewire
@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "roo_onewire.h"
+#include "roo_onewire/bus_simulation.h"
+#include "roo_scheduler.h"
+#include "roo_time.h"
+#include "test_bus.h"
+
+namespace roo_onewire {
+
+namespace {
+
+using roo_time::Seconds;
+using roo_time::Uptime;
+
+// Records the early readings, and the state of the bus and of the other
+// thermometers at the time.
+class ReadingListener : public Thermometers::EventListener {
+ public:
+  ReadingListener(OneWire& onewire)
+      : onewire_(onewire), calls_(0), bus_busy_(false), others_read_(0) {}
+
+  void readingAvailable(const Thermometer& thermometer) const override {
+    ++calls_;
+    rom_code_ = thermometer.rom_code();
+    bus_busy_ = onewire_.arbiter().isBusy();
+    others_read_ = 0;
+    for (const Thermometer& t : onewire_.thermometers()) {
+      if (t.rom_code() != thermometer.rom_code() &&
+          t.reading_time() == thermometer.reading_time()) {
+        ++others_read_;
+      }
+    }
+  }
+
+  int calls() const { return calls_; }
+  RomCode rom_code() const { return rom_code_; }
+  bool bus_busy() const { return bus_busy_; }
+  int others_read() const { return others_read_; }
+
+ private:
+  OneWire& onewire_;
+  mutable int calls_;
+  mutable RomCode rom_code_;
+  mutable bool bus_busy_;
+  mutable int others_read_;
+};
+
+// Removes itself upon the first early reading.
+class OneShotListener : public Thermometers::EventListener {
+ public:
+  OneShotListener(Thermometers& thermometers)
+      : thermometers_(thermometers), calls_(0) {}
+
+  void readingAvailable(const Thermometer& /*thermometer*/) const override {
+    ++calls_;
+    thermometers_.removeEventListener(const_cast<OneShotListener*>(this));
+  }
+
+  int calls() const { return calls_; }
+
+ private:
+  Thermometers& thermometers_;
+  mutable int calls_;
+};
+
+// Records the bus state changes.
+class BusStateListener : public Thermometers::EventListener {
+ public:
+  void busStateChanged(Thermometers::BusState state) const override {
+    states_.push_back(state);
+  }
+
+  const std::vector<Thermometers::BusState>& states() const { return states_; }
+
+ private:
+  mutable std::vector<Thermometers::BusState> states_;
+};
+
+// Runs a full read period of conversion cycles, and returns the bus time spent
+// on them, excluding discovery.
+int64_t CyclesBusTime(OneWire& onewire, roo_scheduler::Scheduler& scheduler) {
+  onewire.resetBusStats();
+  for (int i = 0; i < 16; ++i) {
+    onewire.update();
+    Wait(scheduler, onewire.thermometers());
+  }
+  return onewire.busStats().bus_time_micros -
+         onewire.discoveryStats().bus_time_micros;
+}
+
+}  // namespace
+
+TEST(Thermometers, RequestReadingJoinsFullConversion) {
+  TestBus bus(40, 2);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(40, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  int calls = 0;
+  onewire.requestReading(Seconds(10), [&](bool ok) { calls += ok; });
+  EXPECT_TRUE(t.isConversionPending());
+  onewire.requestReading(Seconds(10), [&](bool ok) { calls += ok; });
+  Wait(scheduler, t);
+  EXPECT_EQ(2, calls);
+  // Now fresh; answered immediately.
+  onewire.requestReading(Seconds(10), [&](bool ok) { calls += ok; });
+  EXPECT_EQ(3, calls);
+  EXPECT_FALSE(t.isConversionPending());
+}
+
+TEST(Thermometers, RequestReadingWaitsOutSelectiveConversion) {
+  TestBus bus(41, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(41, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(3, t.count());
+  scheduler.delay(Seconds(5));
+  RomCode first = t.rom_code(0);
+  ASSERT_TRUE(onewire.updateSelected(&first, 1));
+  int calls = 0;
+  onewire.requestReading(Seconds(1), [&](bool ok) { calls += ok; });
+  // Not answered by the selective conversion, but by the full one that
+  // follows it right away.
+  Wait(scheduler, t);
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ(t.lastFullReadingTime(), t.lastReadingTime());
+  for (const Thermometer& thermometer : t) {
+    EXPECT_EQ(t.lastFullReadingTime(), thermometer.reading_time());
+  }
+}
+
+TEST(Thermometers, SelectiveConversionIsNotFresh) {
+  TestBus bus(42, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(42, scheduler);
+  const Thermometers& t = onewire.thermometers();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  Uptime full = t.lastFullReadingTime();
+  scheduler.delay(Seconds(5));
+  RomCode first = t.rom_code(0);
+  ASSERT_TRUE(onewire.updateSelected(&first, 1));
+  Wait(scheduler, t);
+  EXPECT_EQ(full, t.lastFullReadingTime());
+  EXPECT_LT(full, t.lastReadingTime());
+  int calls = 0;
+  onewire.requestReading(Seconds(2), [&](bool ok) { calls += ok; });
+  // The selective conversion has just completed, but the full one is stale.
+  EXPECT_EQ(0, calls);
+  EXPECT_TRUE(t.isConversionPending());
+  Wait(scheduler, t);
+  EXPECT_EQ(1, calls);
+}
+
+TEST(Thermometers, WakeupAccountsForTheReads) {
+  TestBus bus(43, 4);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(43, scheduler);
+  Thermometers& t = onewire.thermometers();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  // Reset, Match ROM, Read Scratchpad, 9 bytes, and the terminating reset.
+  const int64_t full_read =
+      2 * BusTiming::kResetMicros + (8 + 64 + 8 + 72) * BusTiming::kSlotMicros;
+  ASSERT_TRUE(onewire.update());
+  EXPECT_EQ(4 * full_read, t.nextWakeup().duration.inMicros());
+  Wait(scheduler, t);
+
+  // As above, but 2 bytes.
+  const int64_t partial_read = 2 * BusTiming::kResetMicros +
+                               (8 + 64 + 8 + 16) * BusTiming::kSlotMicros;
+  t.setReadIntegrity(Thermometers::READ_INTEGRITY_PARTIAL);
+  ASSERT_TRUE(onewire.update());
+  EXPECT_EQ(4 * partial_read, t.nextWakeup().duration.inMicros());
+  Wait(scheduler, t);
+}
+
+// Partial reads save 56 slots per read: about 31% with Match ROM (12.56 ms to
+// 8.64 ms), and more than half only with Skip ROM, on a single-device bus
+// (12.56 ms to 4.16 ms, counting Skip ROM's own savings).
+TEST(Thermometers, PartialReadsSaveBusTime) {
+  for (int count : {4, 1}) {
+    TestBus bus(49, count);
+    roo_scheduler::Scheduler scheduler;
+    OneWire onewire(49, scheduler);
+    Thermometers& t = onewire.thermometers();
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+    ASSERT_EQ(count, t.count());
+    t.resetReadStats();
+    int64_t full = CyclesBusTime(onewire, scheduler);
+    EXPECT_EQ(16u * count, t.readStats().full_reads);
+    EXPECT_EQ(0u, t.readStats().partial_reads);
+
+    t.setReadIntegrity(Thermometers::READ_INTEGRITY_PARTIAL);
+    t.resetReadStats();
+    int64_t partial = CyclesBusTime(onewire, scheduler);
+    // Each thermometer still gets one full read per 16 conversions.
+    EXPECT_EQ((uint32_t)count, t.readStats().full_reads);
+    EXPECT_EQ(15u * count, t.readStats().partial_reads);
+    EXPECT_EQ(0u, t.readStats().implausible_reads);
+    EXPECT_EQ(count == 1 ? 16u : 0u, t.readStats().skip_rom_reads);
+    // 56 slots saved per partial read, whether addressed with Match ROM or
+    // with Skip ROM.
+    EXPECT_EQ(15 * count * (72 - 16) * BusTiming::kSlotMicros, full - partial)
+        << count << " thermometers";
+  }
+}
+
+TEST(Thermometers, BusDownBacksOffAndRecovers) {
+  TestBus bus(41, 2);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(41, scheduler);
+  Thermometers& t = onewire.thermometers();
+  BusStateListener listener;
+  t.addEventListener(&listener);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(2, t.count());
+  EXPECT_EQ(Thermometers::BUS_HEALTHY, t.busState());
+
+  // The bus gets shorted: no presence pulses at all.
+  BusSimulation::Options options;
+  options.base_presence_failure_rate = 1.0f;
+  BusSimulation shorted(options);
+  onewire.setBusSimulation(&shorted);
+  EXPECT_FALSE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(Thermometers::BUS_DOWN, t.busState());
+
+  // Fails fast, without touching the bus, until the next probe.
+  uint32_t resets = onewire.busStats().resets;
+  EXPECT_FALSE(onewire.update());
+  EXPECT_EQ(resets, onewire.busStats().resets);
+
+  // Probes, with the backoff doubling from 1 s, up to 64 s.
+  roo_time::Interval backoff = Seconds(1);
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_EQ(Uptime::Now() + backoff, t.nextWakeup().time) << "probe " << i;
+    scheduler.delay(backoff - roo_time::Millis(1));
+    EXPECT_FALSE(onewire.update());
+    EXPECT_EQ(resets, onewire.busStats().resets);
+    scheduler.delay(roo_time::Millis(1));
+    EXPECT_FALSE(onewire.update());
+    EXPECT_EQ(++resets, onewire.busStats().resets) << "probe " << i;
+    backoff = std::min(backoff * 2, Seconds(64));
+  }
+
+  // Repaired: degraded at first, healthy after three clean cycles (the first
+  // one started by the probe).
+  onewire.setBusSimulation(nullptr);
+  scheduler.delay(backoff);
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+    EXPECT_EQ(Thermometers::BUS_DEGRADED, t.busState()) << "cycle " << i;
+  }
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(Thermometers::BUS_HEALTHY, t.busState());
+
+  std::vector<Thermometers::BusState> expected = {Thermometers::BUS_DOWN,
+                                                  Thermometers::BUS_DEGRADED,
+                                                  Thermometers::BUS_HEALTHY};
+  EXPECT_EQ(expected, listener.states());
+  t.removeEventListener(&listener);
+}
+
+TEST(Thermometers, ReadingAvailableDeliveredEarly) {
+  for (bool deferred : {false, true}) {
+    TestBus bus(46, 3);
+    roo_scheduler::Scheduler scheduler;
+    OneWire onewire(46, scheduler);
+    Thermometers& t = onewire.thermometers();
+    t.setDeferredDispatch(deferred);
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+    ASSERT_EQ(3, t.count());
+    RomCode critical = t.rom_code(2);
+    t.setReadPriority(critical, 1);
+    ReadingListener listener(onewire);
+    OneShotListener one_shot(t);
+    t.addEventListener(&one_shot);
+    t.addEventListener(&listener);
+    scheduler.delay(Seconds(1));
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+    EXPECT_EQ(1, listener.calls()) << "deferred: " << deferred;
+    EXPECT_EQ(critical, listener.rom_code()) << "deferred: " << deferred;
+    // Before the other thermometers have been read.
+    EXPECT_EQ(0, listener.others_read()) << "deferred: " << deferred;
+    // If deferred, outside of the bus transaction.
+    EXPECT_EQ(!deferred, listener.bus_busy()) << "deferred: " << deferred;
+    // The removal, from within the listener, takes effect.
+    scheduler.delay(Seconds(1));
+    ASSERT_TRUE(onewire.update());
+    Wait(scheduler, t);
+    EXPECT_EQ(1, one_shot.calls()) << "deferred: " << deferred;
+    EXPECT_EQ(2, listener.calls()) << "deferred: " << deferred;
+    t.removeEventListener(&listener);
+  }
+}
+
+TEST(Thermometers, PowerOnResetValueConvertedAgain) {
+  TestBus bus(47, 3);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(47, scheduler);
+  Thermometers& t = onewire.thermometers();
+  BusSimulation simulation;
+  onewire.setBusSimulation(&simulation);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(3, t.count());
+  int16_t raw[3];
+  for (int i = 0; i < 3; ++i) raw[i] = t.thermometer(i).raw_temperature();
+  scheduler.delay(Seconds(1));
+  Uptime previous = t.lastReadingTime();
+  // One of the devices browns out during the conversion.
+  simulation.injectPowerOnResets(1);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(1u, simulation.injectedPowerOnResets());
+  // Converted again, and read fine.
+  EXPECT_EQ(0u, t.readStats().failed_reads);
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(raw[i], t.thermometer(i).raw_temperature()) << i;
+    EXPECT_LT(previous, t.thermometer(i).reading_time()) << i;
+  }
+}
+
+TEST(Thermometers, PowerOnResetValueAfterReconversionFails) {
+  TestBus bus(48, 1);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(48, scheduler);
+  Thermometers& t = onewire.thermometers();
+  BusSimulation simulation;
+  onewire.setBusSimulation(&simulation);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(1, t.count());
+  scheduler.delay(Seconds(1));
+  Uptime previous = t.lastReadingTime();
+  // The device browns out again, during the re-conversion.
+  simulation.injectPowerOnResets(2);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(2u, simulation.injectedPowerOnResets());
+  EXPECT_EQ(1u, t.readStats().failed_reads);
+  // Not 85 °C; the previous reading, with its time.
+  EXPECT_EQ(20 * 16, t.thermometer(0).raw_temperature());
+  EXPECT_EQ(previous, t.thermometer(0).reading_time());
+}
+
+// Under roo_testing, the overdrive ROM commands are sent at standard speed (see
+// Bus), so the overdrive timing itself is not exercised; the simulation flips
+// the bits read in overdrive.
+TEST(Thermometers, OverdriveSuspendedWhenUnreliable) {
+  TestBus bus(44, 3, 0x42);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(44, scheduler);
+  Thermometers& t = onewire.thermometers();
+  BusSimulation::Options options;
+  options.overdrive_bit_error_rate = 1.0f;
+  BusSimulation simulation(options);
+  onewire.setBusSimulation(&simulation);
+  ASSERT_TRUE(t.isOverdrive());
+  EXPECT_FALSE(t.isOverdriveSuspended());
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(3, t.count());
+  // Each read failed in overdrive, and succeeded at standard speed.
+  EXPECT_EQ(0u, t.readStats().failed_reads);
+  for (const Thermometer& thermometer : t) {
+    EXPECT_NE(kUnknownRawTemperature, thermometer.raw_temperature());
+  }
+  EXPECT_TRUE(t.isOverdrive());
+  EXPECT_TRUE(t.isOverdriveSuspended());
+
+  // While suspended, everything goes at standard speed.
+  onewire.resetBusStats();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_EQ(0u, onewire.busStats().overdrive_slots);
+  EXPECT_EQ(0u, t.readStats().failed_reads);
+
+  // Tried again, eventually; now reliable.
+  onewire.setBusSimulation(nullptr);
+  scheduler.delay(Seconds(601));
+  EXPECT_FALSE(t.isOverdriveSuspended());
+  onewire.resetBusStats();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_LT(0u, onewire.busStats().overdrive_slots);
+  EXPECT_FALSE(t.isOverdriveSuspended());
+}
+
+TEST(Thermometers, OverdriveKeptAfterSingleFallback) {
+  TestBus bus(45, 1, 0x42);
+  roo_scheduler::Scheduler scheduler;
+  OneWire onewire(45, scheduler);
+  Thermometers& t = onewire.thermometers();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  ASSERT_EQ(1, t.count());
+  BusSimulation::Options options;
+  options.overdrive_bit_error_rate = 1.0f;
+  BusSimulation simulation(options);
+  onewire.setBusSimulation(&simulation);
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  onewire.setBusSimulation(nullptr);
+  EXPECT_EQ(0u, t.readStats().failed_reads);
+  EXPECT_FALSE(t.isOverdriveSuspended());
+  onewire.resetBusStats();
+  ASSERT_TRUE(onewire.update());
+  Wait(scheduler, t);
+  EXPECT_LT(0u, onewire.busStats().overdrive_slots);
+}
+
+}  // namespace roo_onewire